@@ -30,6 +30,8 @@ var autoselect_track = false;
 var detail_clip_id;
 
 var arrangement_clips = [];
+// The chords that rbau.repitch has, as [name, start, end], or null before the first chord track is sent
+var sent_chords = null;
 
 // ---------------------------------------------------------------------------------
 // Debug Methods
@@ -95,18 +97,65 @@ function arrangement_clips_changed(args){
 }
 
 function update_clips(){
-	output_list = [];
+	var chords = [];
 	arrangement_clips = [];
 	for(i=0; i<clipIDs.length; i++){
 		clip = new Clip(clipIDs[i]);
 		// post('clip:', clip.getName(), clip.getProperty('start_time'), clip.getProperty('end_time'), '\n');
 		arrangement_clips.push(clip);
-		output_list.push(clip.getName());
-		output_list.push(clip.getProperty('start_time')[0]);
-		output_list.push(clip.getProperty('end_time')[0]);
+		chords.push([clip.getName(), clip.getProperty('start_time')[0], clip.getProperty('end_time')[0]]);
 	}
-	outlet(0, output_list);
+	chords.sort(function(a, b) { return a[1] - b[1]; });
 
+	// The first time the whole chord track is sent, after that only the range that was edited
+	if(sent_chords === null){
+		outlet(0, ['set_chord_track'].concat(flatten_chords(chords)));
+	}
+	else {
+		send_chord_edit(sent_chords, chords);
+	}
+	sent_chords = chords;
+}
+
+// Send the chords starting in the range from the first to the last chord that was added, moved or removed.
+// replace_chords replaces the chords starting in [start, end), so end is the next start after the range.
+function send_chord_edit(old_chords, new_chords){
+	var old_keys = {};
+	var new_keys = {};
+	old_chords.forEach(function(c){ old_keys[c.join(' ')] = true; });
+	new_chords.forEach(function(c){ new_keys[c.join(' ')] = true; });
+
+	var first = Infinity;
+	var last = -Infinity;
+	var mark = function(keys){
+		return function(c){
+			if(keys[c.join(' ')]) return;
+			first = Math.min(first, c[1]);
+			last = Math.max(last, c[1]);
+		};
+	};
+	old_chords.forEach(mark(new_keys));
+	new_chords.forEach(mark(old_keys));
+	if(first === Infinity) return;
+
+	var end = last + 1;
+	old_chords.concat(new_chords).forEach(function(c){
+		if(c[1] > last && c[1] < end) end = c[1];
+	});
+
+	var in_range = new_chords.filter(function(c){ return c[1] >= first && c[1] < end; });
+	if(in_range.length == 0){
+		outlet(0, 'remove_chords', first, end);
+	}
+	else {
+		outlet(0, ['replace_chords', first, end].concat(flatten_chords(in_range)));
+	}
+}
+
+function flatten_chords(chords){
+	var list = [];
+	chords.forEach(function(c){ list.push(c[0], c[1], c[2]); });
+	return list;
 }
 
 
@@ -14,10 +14,16 @@ var selected_parameter_observer;
 
 var arrangement_clips = [];
 
+var session_clips = [];
+var session_clip_observers = [];
+
 var clipDict = new Dict(jsarguments[1]);
 
 var getNoteParams = new Dict();
 
+// Hashes of the clips in the timeline cache of trork.drum-trigger
+var cached_clip_hashes = {};
+
 
 // ---------------------------------------------------------------------------------
 // Debug Methods
@@ -66,6 +72,10 @@ function init(){
 		arrangement_clips_listener.property = 'arrangement_clips';
 		track_mute_listener = new LiveAPI(arrangement_clips_changed, current_track.getPath());
 		track_mute_listener.property = 'mute';
+		clip_slots_listener = new LiveAPI(clip_slots_changed, current_track.getPath());
+		clip_slots_listener.property = 'clip_slots';
+		fired_slot_listener = new LiveAPI(fired_slot_changed, current_track.getPath());
+		fired_slot_listener.property = 'fired_slot_index';
 		getNoteParams.clear();
 		getNoteParams.set('from_pitch', 0  );
 		getNoteParams.set('pitch_span', 127);
@@ -77,8 +87,13 @@ function init(){
 	clipIDs = current_track.getIDs('arrangement_clips');
 	// log('current_track.getIDs(\'arrangement_clips\'):', clipIDs);
 
-	// Fill the arrangement_clips array with Clip objects
-	update_clips();
+	// Ask trork.drum-trigger for the hashes of its timeline cache, and send the clips once they have arrived,
+	// so only the clips that are not in the cache are sent
+	outlet(0, 'read_timeline');
+	resend_task.schedule(0);
+
+	// Send the session clips ahead of time, so they can be played early when launched
+	update_session_clips();
 
 	initialised = true;
     // post('initialised\n')
@@ -95,67 +110,182 @@ function arrangement_clips_changed(args){
 	update_clips();
 }
 
+// Messages from the timeline cache of trork.drum-trigger
+// 'hashes ...' after read_timeline: the clips that do not need to be re-sent
+// 'missing hash' after add_cached_clip: the clip was not in the cache after all, so it is sent again
+var resend_task = new Task(update_clips);
+function timeline_cache(){
+	var a = arrayfromargs(arguments);
+	if(a[0] == 'hashes'){
+		cached_clip_hashes = {};
+		for(var i=1; i<a.length; i++){
+			cached_clip_hashes[a[i]] = true;
+		}
+	}
+	else if(a[0] == 'missing'){
+		delete cached_clip_hashes[a[1]];
+		resend_task.schedule(0);
+	}
+}
+
+// Content hash of a clip over the clip properties and notes, as 16 hex characters: two 32 bit FNV-1a lanes
+// with different offset bases, where the second lane also mixes in the first. This is not a 64 bit FNV-1a.
+// The clip id is not part of the hash, as Live assigns new ids when the set is loaded.
+function clip_hash(list){
+	var s = list.join(' ');
+	var h1 = 0x811c9dc5;
+	var h2 = 0xcbf29ce4;
+	for(var i=0; i<s.length; i++){
+		var c = s.charCodeAt(i);
+		// h = (h ^ c) * 16777619, written with shifts to stay within 32 bits
+		h1 ^= c;
+		h1 = (h1 + (h1 << 1) + (h1 << 4) + (h1 << 7) + (h1 << 8) + (h1 << 24)) >>> 0;
+		h2 ^= c;
+		h2 = (h2 + (h2 << 1) + (h2 << 4) + (h2 << 7) + (h2 << 8) + (h2 << 24)) >>> 0;
+		h2 ^= h1 >>> 13;
+	}
+	return ('0000000' + h1.toString(16)).slice(-8) + ('0000000' + h2.toString(16)).slice(-8);
+}
+
+function clip_slots_changed(args){
+	if(!initialised) return;
+	update_session_clips();
+}
+
+// A session clip was launched or stopped. We get this when the clip is triggered, which is before it starts 
+// playing, when launch quantisation is used. trork.drum-trigger then knows the launch time ahead.
+function fired_slot_changed(args){
+	if(!initialised) return;
+	if(args[0] != 'fired_slot_index') return;
+
+	var slot_index = args[1];
+	if(slot_index >= 0){
+		outlet(0, 'launch_session_clip', slot_index, launch_quantisation(slot_index));
+	}
+	else if(slot_index == -2){
+		outlet(0, 'stop_session_clip', launch_quantisation(-1));
+	}
+}
+
+// The launch quantisation in beats for the clip in a slot, or the global quantisation if slot_index is -1
+function launch_quantisation(slot_index){
+	var index = api.get('clip_trigger_quantization')[0];
+
+	if(slot_index >= 0){
+		var clip_slot = new LiveAPI(current_track.getPath() + ' clip_slots ' + slot_index);
+		if(clip_slot.get('has_clip')[0]){
+			var clip = new LiveAPI(current_track.getPath() + ' clip_slots ' + slot_index + ' clip');
+			var clip_index = clip.get('launch_quantization')[0];
+			// 0 is Global, the rest are the global options shifted by one
+			if(clip_index > 0) index = clip_index - 1;
+		}
+	}
+
+	var bar = api.get('signature_numerator')[0] * 4 / api.get('signature_denominator')[0];
+	// None, 8 Bars, 4 Bars, 2 Bars, 1 Bar, 1/2, 1/2T, 1/4, 1/4T, 1/8, 1/8T, 1/16, 1/16T, 1/32
+	var beats = [0, 8*bar, 4*bar, 2*bar, bar, 2, 4/3, 1, 2/3, 1/2, 1/3, 1/4, 1/6, 1/8];
+	if(index < 0 || index >= beats.length) return 0;
+	return beats[index];
+}
+
+// Send all the session clips of the track to trork.drum-trigger
+function update_session_clips(){
+	while(session_clip_observers.length > 0) session_clip_observers.pop().id = 0;
+	session_clips = [];
+	outlet(0, 'clear_session_clips');
+
+	var num_clip_slots = current_track.api.getcount('clip_slots');
+	for(var i=0; i<num_clip_slots; i++){
+		var clip_slot = new LiveAPI(current_track.getPath() + ' clip_slots ' + i);
+		if(!clip_slot.get('has_clip')[0]) continue;
+
+		var clip = new Clip(current_track.getPath() + ' clip_slots ' + i + ' clip');
+		session_clips.push(clip);
+		send_session_clip(i, clip);
+
+		// Send the clip again when its notes are edited
+		var observer = new LiveAPI(session_clip_changed(i, clip), clip.getPath());
+		observer.property = 'notes';
+		session_clip_observers.push(observer);
+	}
+}
+
+// Make the observer callback for the clip in a slot
+function session_clip_changed(slot_index, clip){
+	return function(args){
+		if(!initialised) return;
+		if(args[0] != 'notes') return;
+		send_session_clip(slot_index, clip);
+	};
+}
+
+function send_session_clip(slot_index, clip){
+	var output_list = ['add_session_clip', slot_index].concat(clip_to_list(clip));
+	outlet(0, output_list);
+}
+
+// The clip properties followed by the notes, in the order of the add_clip message
+function clip_to_list(clip){
+	var output_list = [];
+
+	var clip_looping = clip.getProperty('looping')[0];
+	var clip_end_marker = clip.getProperty('end_marker')[0];
+	var clip_loop_end = clip.getProperty('loop_end')[0];
+
+	output_list.push(clip.getID());
+	output_list.push(clip.getName());
+	output_list.push(clip.getProperty('muted')[0]);
+	output_list.push(clip.getProperty('start_time')[0]);
+	output_list.push(clip.getProperty('end_time')[0]);
+	output_list.push(clip.getProperty('start_marker')[0]);
+	output_list.push(clip_end_marker);
+	output_list.push(clip_looping);
+	output_list.push(clip.getProperty('loop_start')[0]);
+	output_list.push(clip_loop_end);
+
+	getNoteParams.set('from_pitch', 0);
+	getNoteParams.set('pitch_span', 128);
+	getNoteParams.set('from_time', 0);
+	getNoteParams.set('time_span', clip_looping ? clip_loop_end : clip_end_marker);
+
+	var notesObject = JSON.parse(clip.api.call('get_notes_extended', getNoteParams));
+	var notesArray = notesObject.notes;
+	notesArray.sort(sortByStartTime);
+	notesArray.forEach(function(note){
+		output_list.push(note.pitch);
+		output_list.push(note.start_time);
+		output_list.push(note.duration);
+		output_list.push(note.velocity);
+	});
+
+	return output_list;
+}
+
 function update_clips(){
 	clipDict.clear();
 	arrangement_clips = [];
 	outlet(0, 'clear_clips');
 	for(i=0; i<clipIDs.length; i++){
-		output_list = ['add_clip'];
-
 		clip = new Clip(clipIDs[i]);
 		// post('clip:', clip.getName(), clip.getProperty('start_time'), clip.getProperty('end_time'), '\n');
 		arrangement_clips.push(clip);
 
-		// Get the clip properties
-		var clip_id = clip.getID();
-		var clip_name = clip.getName();
-		var clip_muted = clip.getProperty('muted')[0];
-		var clip_start_time = clip.getProperty('start_time')[0];
-		var clip_end_time = clip.getProperty('end_time')[0];
-		var clip_start_marker = clip.getProperty('start_marker')[0];
-		var clip_end_marker = clip.getProperty('end_marker')[0];
-		var clip_looping = clip.getProperty('looping')[0];
-		var clip_loop_start = clip.getProperty('loop_start')[0];
-		var clip_loop_end = clip.getProperty('loop_end')[0];
-
-		// Add the clip properties to the output list
-		output_list.push(clip_id);             // 0
-		output_list.push(clip_name);           // 1
-		output_list.push(clip_muted);          // 2
-		output_list.push(clip_start_time);     // 3
-		output_list.push(clip_end_time);       // 4
-		output_list.push(clip_start_marker);   // 5
-		output_list.push(clip_end_marker);     // 6
-		output_list.push(clip_looping);        // 7
-		output_list.push(clip_loop_start);     // 8
-		output_list.push(clip_loop_end);       // 9
-
-		// Parameters for the get_notes_extended call
-		getNoteParams.set('from_pitch', 0);
-		getNoteParams.set('pitch_span', 128);
-		getNoteParams.set('from_time', 0);
-		getNoteParams.set('time_span', clip_looping ? clip_loop_end : clip_end_marker);
-
-		// Get the notes for the clip
-		var notesJson = clip.api.call('get_notes_extended',getNoteParams);
-		var notesObject = JSON.parse(notesJson);
-		var notesArray = notesObject.notes;
-		notesArray.sort(sortByStartTime);
-
-		// log(notesArray);
-
-		notesArray.forEach(function(note){
-			// printNote(note);	
-			output_list.push(note.pitch);          // 0
-			output_list.push(note.start_time);     // 1
-			output_list.push(note.duration);       // 2
-			output_list.push(note.velocity);       // 3
-			// output_list.push(note.note_id);        // 4
-			// printNote(note);
-		});
+		// The clip properties followed by the notes
+		output_list = ['add_clip'].concat(clip_to_list(clip));
 
-		outlet(0, output_list);
+		// Only send clips that are not in the timeline cache. Skip 'add_clip' and the clip id for the hash.
+		var hash = clip_hash(output_list.slice(2));
+		if(cached_clip_hashes[hash]){
+			outlet(0, 'add_cached_clip', hash);
+		}
+		else {
+			output_list[0] = hash;
+			output_list.unshift('add_clip_hashed');
+			outlet(0, output_list);
+			cached_clip_hashes[hash] = true;
+		}
 	}
+	outlet(0, 'clips_done');
 }
 
 function sortByStartTime(a, b) {
@@ -0,0 +1,95 @@
+/// @file
+///	@ingroup 	robotic-audio 
+///	@copyright	Copyright 2025 Hjalte Bested Hjorth. All rights reserved.
+///	@license	Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// The pitches of a chord compiled for quantising: a pitch class mask and the nearest chord pitch for every midi pitch.
+// Built once when a chord becomes current, so quantising a note is a single lookup.
+class QuantTable {
+public:
+    QuantTable() { from_mask(0); }
+    explicit QuantTable(const std::vector<int>& pitches) { from_pitches(pitches); }
+
+    void from_pitches(const std::vector<int>& pitches) {
+        int mask = 0;
+        for(auto p : pitches) {
+            if(p >= 0 && p < 128) mask |= 1 << pitch_class(p);
+        }
+        from_mask(mask);
+    }
+
+    void from_mask(int mask) {
+        m_mask = mask & 0xFFF;
+
+        // The nearest pitch in the chord, searching downwards first on a tie
+        for(int pitch=0; pitch<128; pitch++) {
+            m_nearest[pitch] = pitch;
+            if(empty() || contains(pitch)) continue;
+            for(int i=1; i<7; i++) {
+                if(contains(pitch - i)) { m_nearest[pitch] = pitch - i; break; }
+                if(contains(pitch + i)) { m_nearest[pitch] = pitch + i; break; }
+            }
+        }
+    }
+
+    // Is the pitch class of a pitch in the chord
+    bool contains(int pitch) const { return (m_mask >> pitch_class(pitch)) & 1; }
+
+    // Get the nearest pitch in the chord. The result may be outside 0-127, as it is not folded into a range.
+    int nearest(int pitch) const {
+        if(pitch >= 0 && pitch < 128) return m_nearest[pitch];
+        // Outside the table, use the distance found for the same pitch class
+        const int in_table = 60 + pitch_class(pitch);
+        return pitch + m_nearest[in_table] - in_table;
+    }
+
+    // A chord without pitches can not quantise
+    bool empty() const { return m_mask == 0; }
+
+    // The pitch classes in the chord, bit 0 is C
+    int mask() const { return m_mask; }
+
+private:
+    static int pitch_class(int pitch) { return ((pitch % 12) + 12) % 12; }
+
+    int m_mask = 0;
+    std::array<int, 128> m_nearest;
+};
+
+// The harmonic context that rbau.repitch shares with the other objects of the package, e.g. rbau.repitch~.
+// The context is a process wide static. The current chord is packed into one atomic word, the pitch class mask
+// in the low 12 bits and a serial that counts the chord changes above them. It can be read from the audio thread without a lock.
+class HarmonicContext {
+public:
+    // Publish a new chord
+    static void publish(int mask) {
+        auto& word = get_word();
+        uint64_t current = word.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next = ((serial(current) + 1) << c_mask_bits) | static_cast<uint64_t>(mask & c_mask);
+        } while(!word.compare_exchange_weak(current, next, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Read the context, use mask() and serial() to unpack it
+    static uint64_t read() { return get_word().load(std::memory_order_acquire); }
+
+    static int      mask(uint64_t word)   { return static_cast<int>(word & c_mask); }
+    static uint64_t serial(uint64_t word) { return word >> c_mask_bits; }
+
+private:
+    static constexpr int      c_mask_bits = 12;
+    static constexpr uint64_t c_mask = (1 << c_mask_bits) - 1;
+
+    static std::atomic<uint64_t>& get_word() {
+        static std::atomic<uint64_t> word {0};
+        return word;
+    }
+};
@@ -0,0 +1,45 @@
+/// @file
+///	@ingroup 	robotic-audio
+///	@copyright	Copyright 2025 Hjalte Bested Hjorth. All rights reserved.
+///	@license	Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include "c74_min.h"
+
+// The transport of the Live Set, read directly from the "live" ITM (the time object Max for Live keeps in sync with Live),
+// instead of from observers that send number, tempo and playing messages through the patcher.
+class ItmTransport {
+public:
+    // Ticks per quarter note of the ITM
+    static constexpr double c_ticks_per_beat = 480.0;
+
+    ItmTransport() = default;
+    ItmTransport(const ItmTransport&) = delete;
+    ItmTransport& operator=(const ItmTransport&) = delete;
+
+    ~ItmTransport() {
+        if(m_itm) c74::max::itm_dereference(m_itm);
+    }
+
+    // Read the transport, returns false if there is no ITM
+    bool read() {
+        if(!m_itm) m_itm = static_cast<c74::max::t_itm*>(c74::max::itm_getnamed(c74::max::gensym("live"), nullptr, nullptr, 1L));
+        if(!m_itm) return false;
+
+        beats   = c74::max::itm_getticks(m_itm) / c_ticks_per_beat;
+        tempo   = c74::max::itm_gettempo(m_itm);
+        playing = c74::max::itm_getstate(m_itm) != 0;
+        c74::max::itm_gettimesignature(m_itm, &numerator, &denominator);
+        return true;
+    }
+
+    double beats       = 0.0;
+    double tempo       = 120.0;
+    bool   playing     = false;
+    long   numerator   = 4;
+    long   denominator = 4;
+
+private:
+    c74::max::t_itm* m_itm = nullptr;
+};
@@ -0,0 +1,142 @@
+/// @file
+///	@ingroup 	robotic-audio
+///	@copyright	Copyright 2025 Hjalte Bested Hjorth. All rights reserved.
+///	@license	Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Delivers notifications only to the instances that have subscribed to their type.
+// The subscribers of a type are an immutable list that is replaced on every subscribe and unsubscribe, so a notify
+// takes the current list under the mutex once, without copying it, and notifies after the mutex is released. A notified
+// instance can itself notify, subscribe or unsubscribe. An instance that has unsubscribed is skipped, and unsubscribe_all
+// waits for notifications on other threads to finish, so an instance can not be destroyed while it is being notified.
+template<class T, class Type>
+class NotificationBus {
+public:
+    NotificationBus() {
+        for(auto& subscribers : m_subscribers) subscribers = std::make_shared<const Subscribers>();
+        m_notifying.reserve(c_threads);
+    }
+
+    void subscribe(T* instance, Type type) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& subscribers = m_subscribers[static_cast<int>(type)];
+        if(contains(*subscribers, instance)) return;
+        auto changed = std::make_shared<Subscribers>(*subscribers);
+        changed->push_back(instance);
+        subscribers = changed;
+    }
+
+    void unsubscribe(T* instance, Type type) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        remove(instance, type);
+    }
+
+    // Unsubscribe from all types. Called from the destructor of the instance.
+    void unsubscribe_all(T* instance) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for(int type=0; type<c_num_types; type++) remove(instance, static_cast<Type>(type));
+        m_idle.wait(lock, [this] { return m_num_notifying == count_notifying(std::this_thread::get_id()); });
+    }
+
+    // Notify the subscribers of a type. Pass the instance that is notifying.
+    void notify(T* notifying_instance, Type type) {
+        std::shared_ptr<const Subscribers> subscribers;
+        long unsubscribed;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            subscribers = m_subscribers[static_cast<int>(type)];
+            unsubscribed = m_unsubscribed.load();
+            enter(std::this_thread::get_id());
+        }
+
+        for(auto instance : *subscribers) {
+            // Only when an instance has unsubscribed since, look up whether this one still is
+            if(m_unsubscribed.load() != unsubscribed && !is_subscribed(instance, type)) continue;
+            instance->notify(notifying_instance, type);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            leave(std::this_thread::get_id());
+        }
+        m_idle.notify_all();
+    }
+
+    size_t num_subscribers(Type type) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_subscribers[static_cast<int>(type)]->size();
+    }
+
+private:
+    using Subscribers = std::vector<T*>;
+    static constexpr int c_num_types = static_cast<int>(Type::enum_count);
+    // The threads that are expected to notify at the same time, more only cost an allocation
+    static constexpr size_t c_threads = 8;
+
+    static bool contains(const Subscribers& subscribers, T* instance) {
+        return std::find(subscribers.begin(), subscribers.end(), instance) != subscribers.end();
+    }
+
+    // Remove an instance from a type, with the mutex locked
+    void remove(T* instance, Type type) {
+        auto& subscribers = m_subscribers[static_cast<int>(type)];
+        if(!contains(*subscribers, instance)) return;
+        auto changed = std::make_shared<Subscribers>();
+        for(auto subscriber : *subscribers) {
+            if(subscriber != instance) changed->push_back(subscriber);
+        }
+        subscribers = changed;
+        m_unsubscribed++;
+    }
+
+    bool is_subscribed(T* instance, Type type) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return contains(*m_subscribers[static_cast<int>(type)], instance);
+    }
+
+    // Count the notifies in progress per thread, with the mutex locked
+    void enter(std::thread::id thread) {
+        m_num_notifying++;
+        for(auto& notifying : m_notifying) {
+            if(notifying.first == thread) { notifying.second++; return; }
+        }
+        m_notifying.push_back({thread, 1});
+    }
+
+    void leave(std::thread::id thread) {
+        m_num_notifying--;
+        for(auto it = m_notifying.begin(); it != m_notifying.end(); ++it) {
+            if(it->first != thread) continue;
+            if(--it->second == 0) m_notifying.erase(it);
+            return;
+        }
+    }
+
+    int count_notifying(std::thread::id thread) const {
+        for(const auto& notifying : m_notifying) {
+            if(notifying.first == thread) return notifying.second;
+        }
+        return 0;
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::shared_ptr<const Subscribers> m_subscribers[c_num_types];
+
+    // Incremented on every unsubscribe, so a notify knows when it must look up the instances it notifies
+    std::atomic<long> m_unsubscribed {0};
+
+    // The threads that are notifying right now, with the number of notifies in progress on each
+    std::vector<std::pair<std::thread::id, int>> m_notifying;
+    int m_num_notifying = 0;
+};
@@ -5,16 +5,32 @@
 
 #include "c74_min.h"
 #include <set>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include "Scale.h"
 #include "Chord.h"
 #include "Note.h"
 #include "Interval.h"
 #include "Arp.h"
+#include "rbau.harmonic_context.h"
+#include "rbau.itm_transport.h"
+#include "rbau.notification_bus.h"
 
 using namespace c74::min;
 
-// A class to represent a note. A note that can be repitched, therefore we store both pitch_in and pitch_out.
-
 
 class LiveSet {
 public:
@@ -24,31 +40,174 @@ public:
     void set_tempo     (double a_tempo   ) { tempo      = a_tempo;      }
     void set_beats     (double a_beats   ) { beats      = a_beats;      }
     void set_is_playing(bool a_is_playing) { is_playing = a_is_playing; }
+    void set_time_signature(int a_numerator, int a_denominator) {
+        if(a_numerator > 0)   numerator   = a_numerator;
+        if(a_denominator > 0) denominator = a_denominator;
+    }
 
     // Getters
     double get_tempo()      const { return tempo; }
     double get_beats()      const { return beats; }
     bool   get_is_playing() const { return is_playing; }
 
+    // Convert a duration in ms to beats at the current tempo
+    double ms_to_beats(double ms) const { return ms * tempo / 60000.0; }
+
+    // The length of a beat of the time signature, and of a bar, in quarter note beats
+    double get_beat_length() const { return 4.0 / denominator; }
+    double get_bar_length()  const { return numerator * get_beat_length(); }
+
+    // The index of the beat and the bar at the playing position
+    long get_beat_index() const { return static_cast<long>(std::floor(beats / get_beat_length())); }
+    long get_bar_index()  const { return static_cast<long>(std::floor(beats / get_bar_length())); }
+
 private:    
     double tempo = 120.0;      // The Tempo of the Live Set, in BPM.
     double beats = -1.0;       // The current playing position in the Live Set, in beats.
     bool   is_playing = false; // Is Live's transport is running?
+    int    numerator = 4;      // The time signature of the Live Set
+    int    denominator = 4;
+};
+
+// A small and fast random generator (xorshift64*). Every spring has its own, so the random output is reproducible
+// from a seed and no lock is shared between threads.
+class Random {
+public:
+    Random() { seed(1); }
+    explicit Random(uint64_t a_seed) { seed(a_seed); }
+
+    void seed(uint64_t a_seed) {
+        // Spread the seed with splitmix64, the state must not be 0
+        uint64_t z = a_seed + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        m_state = (z ^ (z >> 31)) | 1;
+    }
+
+    uint32_t next() {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return static_cast<uint32_t>((m_state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // A random integer from 0 to n-1
+    int below(int n) { return n > 0 ? static_cast<int>((static_cast<uint64_t>(next()) * static_cast<uint64_t>(n)) >> 32) : 0; }
+
+private:
+    uint64_t m_state;
 };
 
+// A process-wide table of chords, interned by chord symbol. Every chord symbol is parsed once, and the data that is 
+// derived from it is computed once. Entries are never removed, so an index or a pointer to an entry stays valid.
+class ChordCache {
+public:
+    struct Entry {
+        explicit Entry(const std::string& a_symbol) : symbol(a_symbol), chord(a_symbol) {
+            name = chord.toString();
+            pitches = chord.getNotes().getPitch();
+            std::sort(pitches.begin(), pitches.end());
+            root = chord.getRoot().getPitch();
+            bass = chord.getBass().getPitch();
+            low  = pitches.empty() ? root : pitches.front();
+            high = pitches.empty() ? root : pitches.back();
+            quant_table.from_pitches(pitches);
+        }
+
+        // Get a random pitch of the chord
+        int random_pitch(Random& random) const {
+            if(pitches.empty()) return root;
+            return pitches[random.below(static_cast<int>(pitches.size()))];
+        }
+
+        // Get a random pitch of the chord between low and high, in any octave
+        int random_pitch(Random& random, int low, int high) const {
+            low = std::max(low, 0);
+            high = std::min(high, 127);
+            int count = 0;
+            for(int pitch=low; pitch<=high; pitch++) count += quant_table.contains(pitch);
+            if(count == 0) return random_pitch(random);
+
+            int choice = random.below(count);
+            for(int pitch=low; pitch<=high; pitch++) {
+                if(quant_table.contains(pitch) && choice-- == 0) return pitch;
+            }
+            return root;
+        }
+
+        std::string      symbol;
+        std::string      name;
+        cmtk::Chord      chord;
+        std::vector<int> pitches;
+        int              root;
+        int              bass;
+        int              low;
+        int              high;
+        QuantTable       quant_table;
+    };
+
+    // Get the index of the entry for a chord symbol, parsing the chord if it is new
+    static int intern(const std::string& symbol) {
+        auto& table = get_table();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        auto it = table.index.find(symbol);
+        if(it != table.index.end()) return it->second;
+        table.entries.emplace_back(symbol);
+        const int index = static_cast<int>(table.entries.size()) - 1;
+        table.index.emplace(symbol, index);
+        return index;
+    }
+
+    // Get an entry by index
+    static const Entry& get(int index) {
+        auto& table = get_table();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        return table.entries[index];
+    }
+
+    // Get the entry for a chord symbol
+    static const Entry& get(const std::string& symbol) { return get(intern(symbol)); }
+
+    static size_t size() {
+        auto& table = get_table();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        return table.entries.size();
+    }
+
+private:
+    struct Table {
+        std::mutex                           mutex;
+        std::deque<Entry>                    entries;
+        std::unordered_map<std::string, int> index;
+    };
+
+    // Constructed on first use, as chords are interned during static initialisation
+    static Table& get_table() {
+        static Table table;
+        return table;
+    }
+};
+
+
 class ChordTrack {
 public:
     struct TimedChord {
     public:
-        TimedChord() : m_chord(""), m_start(-1), m_end(-1) {}
-        TimedChord(std::string a_chord, double a_start, double a_end) : m_chord(a_chord), m_start(a_start), m_end(a_end) {}
-        cmtk::Chord m_chord;
+        TimedChord() : TimedChord("", -1, -1) {}
+        TimedChord(std::string a_chord, double a_start, double a_end) : m_chord_id(ChordCache::intern(a_chord)), m_start(a_start), m_end(a_end) {
+            m_entry = &ChordCache::get(m_chord_id);
+        }
+        int         m_chord_id;
         double      m_start;
         double      m_end;
 
+        // The interned chord, it is never freed so we keep a pointer to read it without a lock
+        const ChordCache::Entry& entry() const { return *m_entry; }
+
         // Init
         void init() {
-            m_chord = cmtk::Chord();
+            m_chord_id = ChordCache::intern("");
+            m_entry = &ChordCache::get(m_chord_id);
             m_start = -1;
             m_end   = -1;
         }
@@ -58,41 +217,120 @@ public:
             if(m_start < 0)     return false;
             if(m_end < 0)       return false;
             if(m_start > m_end) return false;
-            return m_chord.size() > 0;
+            return !entry().pitches.empty();
         }
 
-        // Compare two TimedChords
-        bool operator==(const TimedChord& other) const { return m_start == other.m_start && m_end == other.m_end && m_chord == other.m_chord; }
+        // Compare two TimedChords, interned chords are equal when their ids are
+        bool operator==(const TimedChord& other) const { return m_start == other.m_start && m_end == other.m_end && m_chord_id == other.m_chord_id; }
         bool operator!=(const TimedChord& other) const { return !(*this == other); }
 
+        // The same chord at the same time, even when its end has been moved
+        bool isSameChord(const TimedChord& other) const { return m_start == other.m_start && m_chord_id == other.m_chord_id; }
+
         // Stream operator to print the chord
         friend std::ostream& operator<<(std::ostream& os, const TimedChord& chord) {
-            os << "TimedChord:(" << chord.m_chord << "," << chord.m_start << "," << chord.m_end << ")";
+            os << "TimedChord:(" << chord.entry().chord << "," << chord.m_start << "," << chord.m_end << ")";
             return os;
         }
+
+    private:
+        const ChordCache::Entry* m_entry;
+    };
+
+    // A position in the chord track. Playback moves forward, so the chord at the next tick is found by checking the 
+    // chord at the cursor and the one after it. Only a seek needs a binary search.
+    struct Cursor {
+        int index = -1;
     };
 
+    // The most chords a track holds. An edit copies the track, so this bounds the cost of an edit.
+    static constexpr int c_max_chords = 4096;
+
     ChordTrack() {}
 
     void from_atoms(const atoms& args) {
         m_chords.clear();
         m_chords.reserve(args.size()/3);
-        for(int i=0; i<args.size(); i+=3) {
+        for(int i=0; i+2<args.size(); i+=3) {
             add_chord(args[i], args[i+1], args[i+2]);
         }
+        // Keep the chords sorted by start time for the lookup
+        std::stable_sort(m_chords.begin(), m_chords.end(), [](const TimedChord& a, const TimedChord& b) { return a.m_start < b.m_start; });
     }
 
     void add_chord(const std::string& a_chord, double a_start, double a_end) {
         m_chords.push_back(TimedChord(a_chord, a_start, a_end));
     }
 
+    // Insert chords in the format of from_atoms, starting at args[first], each at its place by start time
+    void insert_atoms(const atoms& args, size_t first = 0) {
+        for(size_t i=first; i+2<args.size(); i+=3) {
+            insert_chord(args[i], args[i+1], args[i+2]);
+        }
+    }
+
+    // Insert a chord at its place by start time, after the chords that start at the same time
+    void insert_chord(const std::string& a_chord, double a_start, double a_end) {
+        auto it = std::upper_bound(m_chords.begin(), m_chords.end(), a_start, [](double t, const TimedChord& chord) { return t < chord.m_start; });
+        m_chords.insert(it, TimedChord(a_chord, a_start, a_end));
+    }
+
+    // Remove the chords that start in [a_start, a_end), returns how many were removed
+    int remove_chords(double a_start, double a_end) {
+        auto starts_before = [](const TimedChord& chord, double t) { return chord.m_start < t; };
+        auto first = std::lower_bound(m_chords.begin(), m_chords.end(), a_start, starts_before);
+        auto last  = std::lower_bound(first, m_chords.end(), a_end, starts_before);
+        const int removed = static_cast<int>(last - first);
+        m_chords.erase(first, last);
+        return removed;
+    }
+
+    int size() const { return static_cast<int>(m_chords.size()); }
+
+    // Get the index of the same chord as another at the same time, -1 if there is none. Finds a chord again after an edit
+    // has moved the indices.
+    int find_chord(const TimedChord& chord) const {
+        auto it = std::lower_bound(m_chords.begin(), m_chords.end(), chord.m_start, [](const TimedChord& a, double t) { return a.m_start < t; });
+        for(; it != m_chords.end() && it->m_start == chord.m_start; ++it) {
+            if(it->isSameChord(chord)) return static_cast<int>(it - m_chords.begin());
+        }
+        return -1;
+    }
+
+    // Get the index of the chord at time, -1 if there is none. Amortised constant time when time moves forward.
+    int get_chord_index_at_time(double time, Cursor& cursor) const {
+        const int size = static_cast<int>(m_chords.size());
+        int index = cursor.index;
+
+        // Step forward from the cursor, as long as the time has not moved back before it
+        if(index >= -1 && index < size && (index < 0 || m_chords[index].m_start <= time)) {
+            for(int steps=0; steps<c_max_cursor_steps; steps++) {
+                if(index + 1 < size && m_chords[index + 1].m_start <= time) {
+                    index++;
+                    continue;
+                }
+                cursor.index = index;
+                return index;
+            }
+        }
+
+        // Seek with a binary search for the last chord starting at or before time
+        auto it = std::upper_bound(m_chords.begin(), m_chords.end(), time, [](double t, const TimedChord& chord) { return t < chord.m_start; });
+        index = static_cast<int>(it - m_chords.begin()) - 1;
+        cursor.index = index;
+        return index;
+    }
+
+    // Get the TimedChord at an index
+    const TimedChord& get_chord(int index) const {
+        if(index < 0 || index >= static_cast<int>(m_chords.size())) return NoChord;
+        return m_chords[index];
+    }
+
     // Get TimedChord at time
     const TimedChord& get_chord_at_time(double time) const {
-        for(auto it = m_chords.rbegin(); it != m_chords.rend(); ++it) {
-            if(it->m_start <= time) return *it;
-        }
-        // Return an empty chord if no chord is found
-        return NoChord;
+        Cursor cursor;
+        return get_chord(get_chord_index_at_time(time, cursor));
     }
 
     // Stream operator to print the chord track
@@ -107,47 +345,377 @@ public:
 
 
 private:
+    // Steps the cursor takes forward before it seeks instead
+    static constexpr int c_max_cursor_steps = 4;
+
     std::vector<TimedChord> m_chords;
     const TimedChord NoChord = TimedChord("", -1, -1);
 };
 
 
-class Note {
+
+
+// The playing voices of an instance. A note can be repitched, therefore every output pitch has a slot that keeps the 
+// input pitch that started it, and every input pitch has a slot that keeps the output pitch it is playing. 
+// Voices that are part of a played chord have no input pitch.
+class VoiceTable {
 public:
-    Note(int a_pitch_in, int a_pitch_out, int a_velocity);
+    // The input pitch of the voices of a chord
+    static constexpr int c_chord = -1;
+    // An output pitch that is not playing, or an input pitch that is not playing anything
+    static constexpr int c_none = -2;
+
+    VoiceTable() { clear(); }
 
-    long id() { return m_id; }
+    void clear() {
+        m_pitch_in.fill(c_none);
+        m_pitch_out.fill(c_none);
+        m_velocity.fill(0);
+    }
+
+    static bool isValidPitch(int pitch) { return pitch >= 0 && pitch < 128; }
+
+    bool isPlaying(int pitch_out) const { return m_pitch_in[pitch_out] != c_none; }
 
-    int         m_pitch_in;  // pitch we keep for the noteoff
-    int         m_pitch_out; // pitch we keep for the noteon
-    int         m_velocity;  // velocity of the note
+    // The input pitch that started the voice at an output pitch
+    int getPitchIn(int pitch_out) const { return m_pitch_in[pitch_out]; }
 
-    long        m_id;        // unique serial number for each note
+    // The output pitch an input pitch is playing
+    int getPitchOut(int pitch_in) const { return m_pitch_out[pitch_in]; }
 
-    static long s_counter;
+    int getVelocity(int pitch_out) const { return m_velocity[pitch_out]; }
 
-    // Implement a sorting operator for the set
-    bool operator<(const Note& other) const {
-        return m_pitch_out < other.m_pitch_out;
+    // Start a voice at an output pitch that is not playing
+    void start(int pitch_in, int pitch_out, int velocity) {
+        m_pitch_in[pitch_out] = pitch_in;
+        m_velocity[pitch_out] = velocity;
+        if(pitch_in != c_chord) m_pitch_out[pitch_in] = pitch_out;
     }
 
-    // Equality operator to use for deletion etc.
-    bool operator==(const Note& other) const {
-        return m_pitch_out == other.m_pitch_out;
+    // Stop the voice at an output pitch
+    void stop(int pitch_out) {
+        const int pitch_in = m_pitch_in[pitch_out];
+        if(pitch_in >= 0 && m_pitch_out[pitch_in] == pitch_out) m_pitch_out[pitch_in] = c_none;
+        m_pitch_in[pitch_out] = c_none;
+        m_velocity[pitch_out] = 0;
     }
 
-    // Print the note on a stream
-    friend std::ostream& operator<<(std::ostream& os, const Note& note) {
-        os << "Note: " << note.m_pitch_in << " " << note.m_pitch_out << " " << note.m_velocity;
-        return os;
+private:
+    std::array<int, 128> m_pitch_in;
+    std::array<int, 128> m_pitch_out;
+    std::array<int, 128> m_velocity;
+};
+
+// The voices of the physical instruments, shared by all instances, so instances that play the same instrument together
+// never play more notes than it has voices. Every voice is packed into one 64 bit slot, so it is claimed, stolen and 
+// released with a single compare and swap. The number of active voices per instrument decides admission.
+class VoiceBudget {
+public:
+    static constexpr int c_num_insts = 16;
+    static constexpr int c_max_voices = 32;
+
+    // Which voice is taken when an instrument has no free voice
+    enum class steal_modes : int { none, oldest, quietest, lowest_priority, enum_count };
+
+    struct Voice {
+        int owner = 0;
+        int pitch = 0;
+        int velocity = 0;
+        int priority = 0;
+        uint32_t serial = 0;
+
+        bool isValid() const { return owner != 0; }
+    };
+
+    VoiceBudget() {
+        for(auto& inst : m_insts) {
+            for(auto& slot : inst.slots) slot.store(0);
+        }
+    }
+
+    static bool isValidInst(int inst) { return inst >= 1 && inst <= c_num_insts; }
+
+    // Set the number of voices of an instrument, 0 for no limit
+    void setVoices(int inst, int voices) {
+        if(!isValidInst(inst)) return;
+        m_insts[inst - 1].voices.store(std::max(0, std::min(voices, c_max_voices)));
     }
 
+    int getVoices(int inst) const { return isValidInst(inst) ? m_insts[inst - 1].voices.load() : 0; }
+
+    int getActive(int inst) const { return isValidInst(inst) ? m_insts[inst - 1].active.load() : 0; }
+
+    // Claim a voice for a note. Returns false when the note may not play. When a voice is stolen, it is returned in 
+    // stolen, and its owner must stop it.
+    bool claim(int inst, Voice voice, steal_modes steal_mode, Voice& stolen) {
+        stolen = Voice();
+        if(!isValidInst(inst)) return true;
+        Inst& instrument = m_insts[inst - 1];
+        const int voices = instrument.voices.load();
+        if(voices == 0) return true;
+
+        voice.serial = instrument.serial.fetch_add(1) & c_serial_mask;
+        const uint64_t packed = pack(voice);
+
+        // Admit the note when there is a free voice. A note is counted as active before it takes a slot and after it has
+        // left it, and there are never more voices than slots, so an admitted note finds a free slot. The search is 
+        // bounded all the same, a note that finds none is not admitted and may steal a voice instead.
+        if(instrument.active.fetch_add(1) < voices) {
+            for(int attempt=0; attempt<c_claim_attempts; attempt++) {
+                for(auto& slot : instrument.slots) {
+                    uint64_t expected = 0;
+                    if(slot.compare_exchange_strong(expected, packed)) return true;
+                }
+            }
+        }
+        instrument.active.fetch_sub(1);
+
+        // Otherwise take the place of another voice
+        if(steal_mode == steal_modes::none) return false;
+        for(int attempt=0; attempt<c_steal_attempts; attempt++) {
+            int victim = -1;
+            Voice victim_voice;
+            for(int i=0; i<c_max_voices; i++) {
+                const Voice candidate = unpack(instrument.slots[i].load());
+                if(!candidate.isValid()) continue;
+                if(victim < 0 || isBetterVictim(candidate, victim_voice, voice.serial, steal_mode)) {
+                    victim = i;
+                    victim_voice = candidate;
+                }
+            }
+            if(victim < 0) return false;
+            if(steal_mode == steal_modes::lowest_priority && victim_voice.priority > voice.priority) return false;
+
+            uint64_t expected = pack(victim_voice);
+            if(instrument.slots[victim].compare_exchange_strong(expected, packed)) {
+                stolen = victim_voice;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Does an owner hold a voice at a pitch
+    bool holds(int inst, int owner, int pitch) const {
+        if(!isValidInst(inst)) return false;
+        for(const auto& slot : m_insts[inst - 1].slots) {
+            const Voice voice = unpack(slot.load());
+            if(voice.owner == owner && voice.pitch == pitch) return true;
+        }
+        return false;
+    }
+
+    // Release the voice of an owner at a pitch, if it has not been stolen
+    void release(int inst, int owner, int pitch) {
+        if(!isValidInst(inst)) return;
+        Inst& instrument = m_insts[inst - 1];
+        for(auto& slot : instrument.slots) {
+            uint64_t value = slot.load();
+            const Voice voice = unpack(value);
+            if(voice.owner != owner || voice.pitch != pitch) continue;
+            if(slot.compare_exchange_strong(value, 0)) instrument.active.fetch_sub(1);
+            return;
+        }
+    }
+
+private:
+    static constexpr uint32_t c_serial_mask = 0xFFFFFF;
+    static constexpr int c_claim_attempts = 4;
+    static constexpr int c_steal_attempts = 4;
+
+    struct Inst {
+        std::atomic<int> voices {0};
+        std::atomic<int> active {0};
+        std::atomic<uint32_t> serial {0};
+        std::atomic<uint64_t> slots[c_max_voices];
+    };
+
+    // owner: 16 bits, pitch: 8 bits, velocity: 8 bits, priority: 8 bits, serial: 24 bits
+    static uint64_t pack(const Voice& voice) {
+        return  static_cast<uint64_t>(voice.owner & 0xFFFF)
+             | (static_cast<uint64_t>(voice.pitch & 0xFF) << 16)
+             | (static_cast<uint64_t>(voice.velocity & 0xFF) << 24)
+             | (static_cast<uint64_t>(voice.priority & 0xFF) << 32)
+             | (static_cast<uint64_t>(voice.serial & c_serial_mask) << 40);
+    }
+
+    static Voice unpack(uint64_t value) {
+        Voice voice;
+        voice.owner    = static_cast<int>(value & 0xFFFF);
+        voice.pitch    = static_cast<int>((value >> 16) & 0xFF);
+        voice.velocity = static_cast<int>((value >> 24) & 0xFF);
+        voice.priority = static_cast<int>((value >> 32) & 0xFF);
+        voice.serial   = static_cast<uint32_t>(value >> 40) & c_serial_mask;
+        return voice;
+    }
+
+    // Is a voice a better one to steal than the current victim? The age is counted back from now, so the serial may wrap.
+    static bool isBetterVictim(const Voice& voice, const Voice& victim, uint32_t now, steal_modes steal_mode) {
+        const uint32_t age = (now - voice.serial) & c_serial_mask;
+        const uint32_t victim_age = (now - victim.serial) & c_serial_mask;
+        switch(steal_mode) {
+            case steal_modes::oldest:          return age > victim_age;
+            case steal_modes::quietest:        return voice.velocity < victim.velocity || (voice.velocity == victim.velocity && age > victim_age);
+            case steal_modes::lowest_priority: return voice.priority < victim.priority || (voice.priority == victim.priority && age > victim_age);
+            default:                           return false;
+        }
+    }
+
+    Inst m_insts[c_num_insts];
+};
+
+// Recognises the chord of the notes that are held, e.g. by a keyboard player. The held notes are kept as a pitch class 
+// histogram and mask, which is matched against chord templates with bit operations. A new chord is only published when
+// it has been the best match for the hold time and matches better than the chord it replaces, so it does not flap 
+// while the notes of a chord arrive one by one.
+class ChordRecogniser {
+public:
+    static constexpr int c_num_templates = 13;
+    static constexpr int c_num_chords = 12 * c_num_templates;
+
+    void noteOn(int pitch) {
+        if(!VoiceTable::isValidPitch(pitch) || m_held[pitch]) return;
+        m_held[pitch] = true;
+        if(m_histogram[pitch % 12]++ == 0) m_mask |= 1 << (pitch % 12);
+    }
+
+    void noteOff(int pitch) {
+        if(!VoiceTable::isValidPitch(pitch) || !m_held[pitch]) return;
+        m_held[pitch] = false;
+        if(--m_histogram[pitch % 12] == 0) m_mask &= ~(1 << (pitch % 12));
+    }
+
+    void clear() {
+        for(auto& held : m_held) held = false;
+        for(auto& count : m_histogram) count = 0;
+        m_mask = 0;
+        m_pending = -1;
+    }
+
+    // The pitch classes that are held
+    int mask() const { return m_mask; }
+
+    // The pitch class of the lowest held note, -1 if none is held
+    int bass() const {
+        for(int pitch=0; pitch<128; pitch++) {
+            if(m_held[pitch]) return pitch % 12;
+        }
+        return -1;
+    }
+
+    // Is a chord waiting for the hold time to pass?
+    bool pending() const { return m_pending >= 0; }
+
+    // Recognise the chord of the held notes at now in ms. Returns the chord to publish, or -1 when the chord stays.
+    // Nothing is published when all notes are released, the last chord is kept.
+    int update(double now, double hold_ms) {
+        if(m_mask == 0) {
+            m_pending = -1;
+            return -1;
+        }
+
+        const int best = match(m_mask, bass());
+        if(best == m_current || (m_current >= 0 && score(m_mask, best) <= score(m_mask, m_current))) {
+            m_pending = -1;
+            return -1;
+        }
+
+        if(best != m_pending) {
+            m_pending = best;
+            m_pending_since = now;
+        }
+        if(now - m_pending_since < hold_ms) return -1;
+
+        m_current = best;
+        m_pending = -1;
+        return best;
+    }
+
+    // The chord that matches a mask of pitch classes best, -1 for an empty mask. A tie goes to the chord on the bass.
+    static int match(int mask, int bass) {
+        if((mask & 0xFFF) == 0) return -1;
+        int best = -1;
+        int best_score = 0;
+        for(int chord=0; chord<c_num_chords; chord++) {
+            const int s = score(mask, chord) + (root(chord) == bass ? 1 : 0);
+            if(best < 0 || s > best_score) {
+                best = chord;
+                best_score = s;
+            }
+        }
+        return best;
+    }
+
+    // How well a chord matches a mask: its tones that are held count, its tones that are missing and the held pitch 
+    // classes that are not in it count against it
+    static int score(int mask, int chord) {
+        const int tones = chord_mask(chord);
+        const int matched = bits(mask & tones);
+        const int missing = bits(~mask & tones);
+        const int extra   = bits(mask & ~tones & 0xFFF);
+        return 4 * matched - 3 * missing - 2 * extra - (mask & (1 << root(chord)) ? 0 : 2);
+    }
+
+    static int root(int chord) { return chord / c_num_templates; }
+
+    // The pitch classes of a chord
+    static int chord_mask(int chord) {
+        const int r = root(chord);
+        const int intervals = c_templates[chord % c_num_templates].intervals;
+        return ((intervals << r) | (intervals >> (12 - r))) & 0xFFF;
+    }
+
+    // The chord symbol, e.g. Ebm7
+    static std::string symbol(int chord) {
+        return std::string(c_roots[root(chord)]) + c_templates[chord % c_num_templates].suffix;
+    }
+
+private:
+    struct Template {
+        int intervals;
+        const char* suffix;
+    };
+
+    // The intervals of the chords above their root, as pitch class bits
+    static constexpr Template c_templates[c_num_templates] = {
+        {0b000010010001, ""},     {0b000010001001, "m"},    {0b010010010001, "7"},    {0b100010010001, "maj7"},
+        {0b010010001001, "m7"},   {0b000001001001, "dim"},  {0b000100010001, "aug"},  {0b000010100001, "sus4"},
+        {0b000010000101, "sus2"}, {0b010001001001, "m7b5"}, {0b001001001001, "dim7"}, {0b001010010001, "6"},
+        {0b001010001001, "m6"}
+    };
+    static constexpr const char* c_roots[12] = { "C", "Db", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B" };
+
+    static int bits(int value) { return static_cast<int>(std::bitset<12>(value & 0xFFF).count()); }
+
+    bool m_held[128] = {false};
+    int m_histogram[12] = {0};
+    int m_mask = 0;
+
+    int m_current = -1;
+    int m_pending = -1;
+    double m_pending_since = 0.0;
 };
 
 
 
+
 class Springs {
 public:
+    // The modes a spring can find its pitch with
+    enum class spring_modes : int { midinote, quantize, step, root, bass, high, low, rand, arp, chord, enum_count };
+
+    // The parameters of a spring, in the order of their names
+    enum class spring_params : int { midinote, inst, mode, note, transpose, pitch_min, pitch_max, octave_add, velocity, 
+                                     velocity_deviation, duration, arp_style, arp_steps, arp_jump, arp_octaves, arp_reset, latency, recovery, enum_count };
+
+    // How a trigger is routed to the springs of the same instrument
+    enum class alloc_modes : int { off, round_robin, least_recent, nearest_pitch, enum_count };
+
+    static constexpr int c_num_springs = 16;
+    // The number of arp steps that are run to find the period of an arp
+    static constexpr int c_arp_probe_length = 256;
+    static constexpr int c_num_params = static_cast<int>(spring_params::enum_count);
+
     class Spring {
     public:
         Spring() = default;
@@ -156,7 +724,8 @@ public:
         // Parameters
         int midinote = -1;
         int inst = 0;
-        std::string mode = "midinote"; // Options: midinote, quantize, step, bass, root, high, low, rand, arp, chord, lowest 2, lowest 
+        spring_modes mode = spring_modes::midinote;
+        std::string mode_name = "midinote"; // Options: midinote, quantize, step, bass, root, high, low, rand, arp, chord
         int note = 60;
         int transpose = 0;
         int pitch_min = 24;
@@ -170,12 +739,76 @@ public:
         cmtk::ChordArp arp;
         int arp_reset = 0; // 0: Off, 1: Chord, 2: Bar, 3: Beat, 4: Bar & Chord, 5: Beat & Chord
 
+        // The arp sequence over the chord, computed when the chord or the arp parameters change. A trigger is then 
+        // an index increment. The sequence is empty when the arp does not repeat, e.g. a random style.
+        std::vector<int> arp_sequence;
+        const ChordCache::Entry* arp_chord = nullptr;
+        bool arp_changed = true;
+        int arp_position = 0;
+
+        // Get the next pitch of the arp
+        int nextArp(const ChordCache::Entry* chord) {
+            if(arp_changed || chord != arp_chord) prepareArp(chord);
+
+            // Play the arp live, when it has no sequence
+            if(arp_sequence.empty()) return arp.next(chord->chord);
+
+            const int size = static_cast<int>(arp_sequence.size());
+            const int pitch = arp_sequence[arp_position % size];
+            arp_position = (arp_position + 1) % size;
+            return pitch;
+        }
+
+        void resetArp() {
+            arp.reset();
+            arp_position = 0;
+        }
+
+        // Compute the arp sequence over a chord
+        void prepareArp(const ChordCache::Entry* chord) {
+            arp_chord = chord;
+            arp_changed = false;
+            arp_sequence.clear();
+
+            // Run a copy of the arp from the start
+            cmtk::ChordArp probe = arp;
+            probe.reset();
+            std::vector<int> steps(c_arp_probe_length);
+            for(auto& step : steps) step = probe.next(chord->chord);
+
+            // Find the shortest period that repeats through all the steps
+            for(int period=1; period<=c_arp_probe_length/2; period++) {
+                bool repeats = true;
+                for(int i=period; i<c_arp_probe_length && repeats; i++) repeats = steps[i] == steps[i - period];
+                if(repeats) {
+                    arp_sequence.assign(steps.begin(), steps.begin() + period);
+                    break;
+                }
+            }
+        }
+
+        // The time the instrument needs to strike, in ms. The spring plays the chord that is current when it lands.
+        int latency = 0;
+        // Where the spring looks up the chord ahead in the chord track
+        ChordTrack::Cursor cursor;
+
+        // The time the spring needs after a note, before it can play again, in ms
+        int recovery = 0;
+        // When the spring is free again, when it was triggered last and the pitch it played, in ms of the steady clock
+        double busy_until = 0.0;
+        double last_trigger = 0.0;
+        int last_pitch = -1;
+
+        // The random generator of this spring
+        Random random;
+
         // Get the velocity with deviation
-        int getVelocity() const {
+        int getVelocity() {
             int v = velocity;
 
             if(velocity_deviation != 0) {
-                v += (rand() % (2*velocity_deviation)) - velocity_deviation;
+                const int deviation = std::abs(velocity_deviation);
+                v += random.below(2*deviation) - deviation;
             }
 
             if(v < 0) return 0;
@@ -183,113 +816,450 @@ public:
             return v;
         }
 
+        // Take the parameters of another spring, and keep the state of this one
+        void setParams(const Spring& other) {
+            midinote           = other.midinote;
+            inst               = other.inst;
+            mode               = other.mode;
+            mode_name          = other.mode_name;
+            note               = other.note;
+            transpose          = other.transpose;
+            pitch_min          = other.pitch_min;
+            pitch_max          = other.pitch_max;
+            octave_add         = other.octave_add;
+            velocity           = other.velocity;
+            velocity_deviation = other.velocity_deviation;
+            duration           = other.duration;
+            arp                = other.arp;
+            arp_reset          = other.arp_reset;
+            latency            = other.latency;
+            recovery           = other.recovery;
+            arp_changed        = true;
+            arp_position       = 0;
+        }
+
+    };
+
+    // A complete set of compiled springs. Banks are loaded up front and recalled as a whole.
+    class Bank {
+    public:
+        static std::shared_ptr<const Bank> from_dictionary(c74::max::t_dictionary* d) {
+            auto bank = std::make_shared<Bank>();
+            for(int index=0; index<c_num_springs; index++) {
+                bank->springs[index].index = index;
+                for(int param=0; param<c_num_params; param++) {
+                    atom value;
+                    if(c74::max::dictionary_getatom(d, key(index, param), &value) == 0) apply(bank->springs[index], static_cast<spring_params>(param), value);
+                }
+            }
+            return bank;
+        }
+
+        Spring springs[c_num_springs];
     };
 
     Springs() = default;
 
+    // The dictionary key of a parameter, "<index>-<param>". The keys are made once.
+    static const symbol& key(int index, int param) {
+        static const auto keys = []() {
+            std::vector<symbol> keys(c_num_springs * c_num_params);
+            for(int i=0; i<c_num_springs; i++) {
+                for(int p=0; p<c_num_params; p++) keys[i * c_num_params + p] = symbol(std::to_string(i) + "-" + c_param_names[p]);
+            }
+            return keys;
+        }();
+        return keys[index * c_num_params + param];
+    }
+
+    static bool isValidIndex(int index) { return index >= 0 && index < c_num_springs; }
+
+    // Get the parameter from its name, enum_count if the name is unknown
+    static spring_params param_from_name(const std::string& name) {
+        for(int param=0; param<c_num_params; param++) {
+            if(name == c_param_names[param]) return static_cast<spring_params>(param);
+        }
+        return spring_params::enum_count;
+    }
+
+    // Get the mode from its name, enum_count if the name is unknown
+    static spring_modes mode_from_name(const std::string& name) {
+        for(int mode=0; mode<static_cast<int>(spring_modes::enum_count); mode++) {
+            if(name == c_mode_names[mode]) return static_cast<spring_modes>(mode);
+        }
+        return spring_modes::enum_count;
+    }
+
+    // Get the compiled spring. It is only read from the dictionary when the dictionary has changed.
     Spring& getSpring(int index) {
+        if(!isValidIndex(index)) index = 0;
+
+        // A bank was recalled, take all its springs at once
+        auto recall = std::atomic_load(&s_recall);
+        if(recall && recall != m_recall) {
+            m_recall = recall;
+            for(int i=0; i<c_num_springs; i++) {
+                springs[i].setParams(recall->bank->springs[i]);
+                compiled[i] = true;
+            }
+            compiled_version = recall->version;
+        }
+
+        // Another instance, or a reload, has changed the dictionary
+        const long version = s_param_version.load();
+        if(version != compiled_version) {
+            for(auto& is_compiled : compiled) is_compiled = false;
+            compiled_version = version;
+        }
+
         Spring& spring = springs[index];
-        spring.index = index;
+        if(!compiled[index]) {
+            compile(index);
+            compiled[index] = true;
+        }
+        return spring;
+    }
+
+    // Write a parameter to the dictionary and through to the compiled spring
+    void setParam(int index, spring_params param, const atom& value) {
+        param_dict[key(index, static_cast<int>(param))] = value;
+
+        // Keep the compiled spring, and the other compiled springs if no one else changed the dictionary in between 
+        const long version = s_param_version.fetch_add(1);
+        if(compiled_version == version) compiled_version = version + 1;
+        if(compiled[index]) apply(springs[index], param, value);
+        s_spring_versions[index]++;
+    }
 
-        std::string index_str = std::to_string(index);
-
-        // Get midinote value
-        std::string midinote_str = index_str + "-midinote";
-        atom midinote_value = param_dict[symbol(midinote_str)];
-        spring.midinote = midinote_value;
-
-        // Get inst
-        std::string inst_str = index_str + "-inst";
-        atom inst_value = param_dict[symbol(inst_str)];
-        spring.inst = inst_value;
-
-        // Get mode value
-        std::string mode_str = index_str + "-mode";
-        atom mode_value = param_dict[symbol(mode_str)];
-        spring.mode = static_cast<std::string>(mode_value);
-
-        // Get note
-        std::string note_str = index_str + "-note";
-        atom note_value = param_dict[symbol(note_str)];
-        spring.note = note_value;
-
-        // Get transpose
-        std::string transpose_str = index_str + "-transpose";
-        atom transpose_value = param_dict[symbol(transpose_str)];
-        spring.transpose = transpose_value;
-
-        // Get pitch_min value
-        std::string pitch_min_str = index_str + "-pitch_min";
-        atom pitch_min_value = param_dict[symbol(pitch_min_str)];
-        spring.pitch_min = pitch_min_value;
-
-        // Get pitch_max value
-        std::string pitch_max_str = index_str + "-pitch_max";
-        atom pitch_max_value = param_dict[symbol(pitch_max_str)];
-        spring.pitch_max = pitch_max_value;
-
-        // Get octave_add
-        std::string octave_add_str = index_str + "-octave_add";
-        atom octave_add_value = param_dict[symbol(octave_add_str)];
-        spring.octave_add = octave_add_value;
-
-        // Get velocity
-        std::string velocity_str = index_str + "-velocity";
-        atom velocity_value = param_dict[symbol(velocity_str)];
-        spring.velocity = velocity_value;
-
-        // Get velocity deviation
-        std::string velocity_deviation_str = index_str + "-velocity_deviation";
-        atom velocity_deviation_value = param_dict[symbol(velocity_deviation_str)];
-        spring.velocity_deviation = velocity_deviation_value;
-
-        // Get duration
-        std::string duration_str = index_str + "-duration";
-        atom duration_value = param_dict[symbol(duration_str)];
-        spring.duration = duration_value;
-
-        // Get arp_style
-        std::string arp_pattern_str = index_str + "-arp_style";
-        atom arp_pattern_value = param_dict[symbol(arp_pattern_str)];
-        spring.arp.setStyle(static_cast<std::string>(arp_pattern_value));
-
-        // Get arp_steps
-        std::string arp_steps_str = index_str + "-arp_steps";
-        atom arp_steps_value = param_dict[symbol(arp_steps_str)];
-        spring.arp.setSteps(arp_steps_value);
-
-        // Get arp_jump
-        std::string arp_jump_str = index_str + "-arp_jump";
-        atom arp_jump_value = param_dict[symbol(arp_jump_str)];
-        spring.arp.setJump(arp_jump_value);
-
-        // Get arp_octaves
-        std::string arp_octaves_str = index_str + "-arp_octaves";
-        atom arp_octaves_value = param_dict[symbol(arp_octaves_str)];
-        spring.arp.setOctaves(arp_octaves_value);
-
-        // Get arp_reset
-        std::string arp_reset_str = index_str + "-arp_reset";
-        atom arp_reset_value = param_dict[symbol(arp_reset_str)];
-        spring.arp_reset = arp_reset_value;
-        
+    // Choose the spring that plays a note of the spring at index, among the springs of the same instrument. 
+    // A spring is busy for the duration of its note and its recovery. When all are busy, the one that is free first plays.
+    Spring& allocate(int index, int pitch, alloc_modes alloc_mode, double now) {
+        Spring& requested = getSpring(index);
+        if(alloc_mode == alloc_modes::off) return requested;
+
+        // The springs of the instrument, starting after the last triggered one for the round robin
+        int last = -1;
+        double last_trigger = 0.0;
+        for(int i=0; i<c_num_springs; i++) {
+            const Spring& spring = getSpring(i);
+            if(spring.inst == requested.inst && spring.last_trigger > last_trigger) {
+                last = i;
+                last_trigger = spring.last_trigger;
+            }
+        }
+        const int start = last < 0 ? index : last + 1;
+
+        int best = -1;
+        int soonest = index;
+        for(int step=0; step<c_num_springs; step++) {
+            const int i = (start + step) % c_num_springs;
+            const Spring& spring = getSpring(i);
+            if(spring.inst != requested.inst) continue;
+            if(spring.busy_until < springs[soonest].busy_until) soonest = i;
+            if(spring.busy_until > now) continue;
+            if(best < 0) { best = i; if(alloc_mode == alloc_modes::round_robin) break; continue; }
+
+            const Spring& chosen = springs[best];
+            if(alloc_mode == alloc_modes::least_recent && spring.last_trigger < chosen.last_trigger) best = i;
+            if(alloc_mode == alloc_modes::nearest_pitch && pitchDistance(spring, pitch) < pitchDistance(chosen, pitch)) best = i;
+        }
+
+        Spring& spring = springs[best < 0 ? soonest : best];
+        spring.busy_until = now + spring.duration + spring.recovery;
+        spring.last_trigger = now;
+        spring.last_pitch = pitch;
         return spring;
     }
 
-    void chordChanged()
+    // Seed the random generators, every spring gets its own sequence
+    void seed(uint64_t a_seed) {
+        for(int index=0; index<c_num_springs; index++) springs[index].random.seed(a_seed * c_num_springs + index);
+    }
+
+    // Read all springs from the dictionary again, in every instance
+    static void reload() { s_param_version++; }
+
+    // Load a bank from a dictionary, replacing a bank with the same name
+    static void loadBank(const std::string& name, c74::max::t_dictionary* d) {
+        auto bank = Bank::from_dictionary(d);
+        std::lock_guard<std::mutex> lock(s_banks_mutex);
+        s_banks[name] = bank;
+    }
+
+    // Recall a bank in every instance. The bank is written to the dictionary to persist it, and then swapped in 
+    // as a whole, so a trigger sees either the old or the new springs. Returns false if there is no such bank.
+    bool recallBank(const std::string& name) {
+        std::shared_ptr<const Bank> bank;
+        {
+            std::lock_guard<std::mutex> lock(s_banks_mutex);
+            auto it = s_banks.find(name);
+            if(it == s_banks.end()) return false;
+            bank = it->second;
+        }
+
+        for(int index=0; index<c_num_springs; index++) {
+            for(int param=0; param<c_num_params; param++) {
+                param_dict[key(index, param)] = getParam(bank->springs[index], static_cast<spring_params>(param));
+            }
+        }
+
+        auto recall = std::make_shared<Recall>();
+        recall->bank = bank;
+        recall->version = ++s_param_version;
+        std::atomic_store(&s_recall, std::shared_ptr<const Recall>(recall));
+        return true;
+    }
+
+    // Get the names of the loaded banks
+    static std::vector<std::string> bankNames() {
+        std::lock_guard<std::mutex> lock(s_banks_mutex);
+        std::vector<std::string> names;
+        for(const auto& bank : s_banks) names.push_back(bank.first);
+        return names;
+    }
+
+    // Get all parameters of a spring, in the order of c_param_names
+    atoms getParams(int index) {
+        const Spring& spring = getSpring(index);
+        atoms values;
+        for(int param=0; param<c_num_params; param++) values.push_back(getParam(spring, static_cast<spring_params>(param)));
+        return values;
+    }
+
+    // Get the parameters that changed since they were last synced, as name value pairs.
+    // Nothing is compared when the same spring is synced again and no one has changed it in between.
+    atoms getChangedParams(int index) {
+        if(!isValidIndex(index)) index = 0;
+        const long version = s_spring_versions[index].load();
+        const long param_version = s_param_version.load();
+        if(index == synced_index && version == synced_version && param_version == synced_param_version) return {};
+
+        const Spring& spring = getSpring(index);
+        atoms changed;
+        for(int param=0; param<c_num_params; param++) {
+            atom value = getParam(spring, static_cast<spring_params>(param));
+            if(synced[param] && synced_values[param] == value) continue;
+            changed.push_back(symbol(c_param_names[param]));
+            changed.push_back(value);
+            synced_values[param] = value;
+            synced[param] = true;
+        }
+        synced_index = index;
+        synced_version = version;
+        synced_param_version = param_version;
+        return changed;
+    }
+
+    // Send every parameter on the next sync, e.g. after the UI was reopened
+    void resetSync() {
+        for(auto& is_synced : synced) is_synced = false;
+        synced_index = -1;
+    }
+
+    static const char* paramName(int param) { return c_param_names[param]; }
+
+    void chordChanged(const ChordCache::Entry* chord)
     {
         for(auto& spring : springs)
         {
-            if(spring.arp_reset == 1) spring.arp.reset();
+            if(spring.arp_reset == 1 || spring.arp_reset == 4 || spring.arp_reset == 5) spring.resetArp();
         }
     }
 
+    // The transport crossed a beat, or the first beat of a bar
+    void beatChanged(bool is_bar)
+    {
+        for(auto& spring : springs)
+        {
+            if(resetsOnBeat(spring) || (is_bar && resetsOnBar(spring))) spring.resetArp();
+        }
+    }
+
+    static bool resetsOnBeat(const Spring& spring) { return spring.arp_reset == 3 || spring.arp_reset == 5; }
+    static bool resetsOnBar (const Spring& spring) { return spring.arp_reset == 2 || spring.arp_reset == 4; }
+
+    // Does any spring need the beats, or the bars, to reset its arp. A spring that resets on the beat also needs the
+    // bars, as the first beat of a bar is only notified as a bar.
+    void arpResets(bool& needs_beats, bool& needs_bars) {
+        needs_beats = false;
+        needs_bars  = false;
+        for(int index=0; index<c_num_springs; index++) {
+            const Spring& spring = getSpring(index);
+            needs_beats = needs_beats || resetsOnBeat(spring);
+            needs_bars  = needs_bars  || resetsOnBeat(spring) || resetsOnBar(spring);
+        }
+    }
+
+    // The version of the dictionary, changed by every edit, reload and recall
+    static long paramVersion() { return s_param_version.load(); }
+
     // A dictionary for the springs parameters
     dict param_dict = dict(symbol("springs-param-dict"));
-    // Current Spring 
-    int current_spring = 1;
+    // Current Spring, selected and read by the messages on any thread
+    std::atomic<int> current_spring {1};
     // Array of Springs
-    Spring springs[16] = {Spring()}; // 16 Springs. Index 0 is not used. But could be used for copy paste? 
+    Spring springs[c_num_springs] = {Spring()}; // 16 Springs. Index 0 is not used. But could be used for copy paste? 
+
+private:
+    // A recalled bank, with the version of the dictionary it was written as
+    struct Recall {
+        std::shared_ptr<const Bank> bank;
+        long version;
+    };
+
+    // How far a spring has to move to play a pitch. A spring that has not played yet is the farthest.
+    static int pitchDistance(const Spring& spring, int pitch) {
+        if(spring.last_pitch < 0) return 128;
+        return std::abs(spring.last_pitch - pitch);
+    }
+
+    // Read a spring from the dictionary
+    void compile(int index) {
+        Spring& spring = springs[index];
+        spring.index = index;
+        for(int param=0; param<c_num_params; param++) {
+            atom value = param_dict[key(index, param)];
+            apply(spring, static_cast<spring_params>(param), value);
+        }
+    }
+
+    // Get a parameter of a compiled spring
+    static atom getParam(const Spring& spring, spring_params param) {
+        switch(param) {
+            case spring_params::midinote:           return spring.midinote;
+            case spring_params::inst:               return spring.inst;
+            case spring_params::mode:               return symbol(spring.mode_name);
+            case spring_params::note:               return spring.note;
+            case spring_params::transpose:          return spring.transpose;
+            case spring_params::pitch_min:          return spring.pitch_min;
+            case spring_params::pitch_max:          return spring.pitch_max;
+            case spring_params::octave_add:         return spring.octave_add;
+            case spring_params::velocity:           return spring.velocity;
+            case spring_params::velocity_deviation: return spring.velocity_deviation;
+            case spring_params::duration:           return spring.duration;
+            case spring_params::arp_style:          return symbol(spring.arp.getStyle());
+            case spring_params::arp_steps:          return spring.arp.getSteps();
+            case spring_params::arp_jump:           return spring.arp.getJump();
+            case spring_params::arp_octaves:        return spring.arp.getOctaves();
+            case spring_params::arp_reset:          return spring.arp_reset;
+            case spring_params::latency:            return spring.latency;
+            case spring_params::recovery:           return spring.recovery;
+            case spring_params::enum_count:         break;
+        }
+        return {};
+    }
+
+    // Set a parameter of a compiled spring
+    static void apply(Spring& spring, spring_params param, const atom& value) {
+        switch(param) {
+            case spring_params::midinote:           spring.midinote = value; break;
+            case spring_params::inst:               spring.inst = value; break;
+            case spring_params::mode:
+                spring.mode_name = static_cast<std::string>(value);
+                spring.mode = mode_from_name(spring.mode_name);
+                break;
+            case spring_params::note:               spring.note = value; break;
+            case spring_params::transpose:          spring.transpose = value; break;
+            case spring_params::pitch_min:          spring.pitch_min = value; break;
+            case spring_params::pitch_max:          spring.pitch_max = value; break;
+            case spring_params::octave_add:         spring.octave_add = value; break;
+            case spring_params::velocity:           spring.velocity = value; break;
+            case spring_params::velocity_deviation: spring.velocity_deviation = value; break;
+            case spring_params::duration:           spring.duration = value; break;
+            case spring_params::arp_style:          spring.arp.setStyle(static_cast<std::string>(value)); spring.arp_changed = true; break;
+            case spring_params::arp_steps:          spring.arp.setSteps(value); spring.arp_changed = true; break;
+            case spring_params::arp_jump:           spring.arp.setJump(value); spring.arp_changed = true; break;
+            case spring_params::arp_octaves:        spring.arp.setOctaves(value); spring.arp_changed = true; break;
+            case spring_params::arp_reset:          spring.arp_reset = value; break;
+            case spring_params::latency:            spring.latency = value; break;
+            case spring_params::recovery:           spring.recovery = value; break;
+            case spring_params::enum_count:         break;
+        }
+    }
+
+    static constexpr const char* c_param_names[c_num_params] = {
+        "midinote", "inst", "mode", "note", "transpose", "pitch_min", "pitch_max", "octave_add", "velocity",
+        "velocity_deviation", "duration", "arp_style", "arp_steps", "arp_jump", "arp_octaves", "arp_reset", "latency", "recovery"
+    };
+    static constexpr const char* c_mode_names[static_cast<int>(spring_modes::enum_count)] = {
+        "midinote", "quantize", "step", "root", "bass", "high", "low", "rand", "arp", "chord"
+    };
+
+    // Changed whenever the dictionary is written, as all instances share it
+    static std::atomic<long> s_param_version;
+    // Changed whenever a parameter of that spring is set
+    static std::atomic<long> s_spring_versions[c_num_springs];
+
+    // The loaded banks by name, and the bank that was recalled last
+    static std::mutex s_banks_mutex;
+    static std::map<std::string, std::shared_ptr<const Bank>> s_banks;
+    static std::shared_ptr<const Recall> s_recall;
+
+    bool compiled[c_num_springs] = {false};
+    long compiled_version = -1;
+    std::shared_ptr<const Recall> m_recall;
+
+    // The parameters that were synced last
+    int synced_index = -1;
+    long synced_version = -1;
+    long synced_param_version = -1;
+    bool synced[c_num_params] = {false};
+    atom synced_values[c_num_params];
+};
+
+// A bounded queue that many threads push to without locks, and one thread pops from in the order they were pushed. 
+// Every cell has a sequence number that tells whether it is free for the producer or ready for the consumer. 
+// A push to a full queue fails instead of waiting.
+template<class T, size_t Size>
+class MpscQueue {
+    static_assert(Size > 0 && (Size & (Size - 1)) == 0, "The size of the queue must be a power of two.");
+public:
+    MpscQueue() {
+        for(size_t i=0; i<Size; i++) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Push from any thread, returns false if the queue is full
+    bool push(const T& value) {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell& cell = m_cells[position & (Size - 1)];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if(difference == 0) {
+                if(m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(difference < 0) {
+                return false;
+            }
+            else {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Pop on the consumer thread only, returns false if the queue is empty
+    bool pop(T& value) {
+        Cell& cell = m_cells[m_head & (Size - 1)];
+        if(cell.sequence.load(std::memory_order_acquire) != m_head + 1) return false;
+        value = cell.value;
+        cell.sequence.store(m_head + Size, std::memory_order_release);
+        m_head++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell m_cells[Size];
+    std::atomic<size_t> m_tail {0};
+    size_t m_head = 0;
 };
 
 class repitch : public object<repitch> {
@@ -303,21 +1273,50 @@ public:
     enum class notefication_type {
         chord_changed,
         playing_changed,
+        tick,
+        beat,
+        bar,
         enum_count
     };
 
     // Constructor
     repitch(const atoms& args = {}) {
         // Add this instance to the list of instances
-        s_instances.insert(this);
+        {
+            std::lock_guard<std::mutex> lock(s_instances_mutex);
+            s_instances.insert(this);
+        }
         // Optionally, print the number of instances to the console
         // cout << "Number of instances: " << s_instances.size() << endl;
+
+        // Every instance plays and bangs on chord changes. Only instances with a latency or an offset need the ticks,
+        // and only instances with springs that reset their arps on them need the beats and bars.
+        s_bus.subscribe(this, notefication_type::chord_changed);
+        s_bus.subscribe(this, notefication_type::playing_changed);
+
+        // Seed the random generators, they are seeded again from the seed attribute when the transport starts
+        reseed();
+        update_arp_subscriptions();
+
+        // Publish the initial chord, if no chord has been published yet
+        if(HarmonicContext::serial(HarmonicContext::read()) == 0) HarmonicContext::publish(current_chord()->quant_table.mask());
     }
 
     // Destructor
     ~repitch() {
-        // Remove this instance from the list of instances
-        s_instances.erase(this);
+        // Remove this instance from the list of instances, after this no other instance queues input for it
+        {
+            std::lock_guard<std::mutex> lock(s_instances_mutex);
+            s_instances.erase(this);
+        }
+        s_bus.unsubscribe_all(this);
+
+        // Another instance takes over the clock
+        repitch* owner = this;
+        s_clock_owner.compare_exchange_strong(owner, nullptr);
+
+        // Give the voices of the instrument back
+        for(int pitch_out=0; pitch_out<128; pitch_out++) releaseVoice(pitch_out);
 
         // Optionally, print the number of instances to the console
         // cout << "Number of instances: " << s_instances.size() << endl;
@@ -331,52 +1330,116 @@ public:
     outlet<thread_check::scheduler, thread_action::fifo> out2 { this, "(bang) when the chord changes" };
 
     // The playing position in the Live Set, in beats.
-    message<threadsafe::yes> number { this, "number", "The playing position in the Live Set, in beats.", 
+    message<threadsafe::yes> number { this, "number", "The playing position in the Live Set, in beats. Ignored when the transport is itm.", 
         MIN_FUNCTION {
-            s_live_set.set_beats(static_cast<double>(args[0]) - offset);
+            if(transport == transport_modes::itm) return {};
 
-            // Get the new chord
-            const auto& new_chord = s_chord_track.get_chord_at_time(s_live_set.get_beats());
+            // The clock owner follows the clock for all instances
+            if(!is_clock_owner()) return {};
 
-            // If the chord has changed
-            if(new_chord != s_current_chord) {
-                s_current_chord = new_chord;
-                s_chord = new_chord.m_chord;
-                s_pitch_vector = s_chord.getNotes().getPitch();
-                notify_all(this, notefication_type::chord_changed);
-            }
+            clock_tick(args[0]);
  
             return {};
         }  
     };
 
     // Is Live's transport is running?
-    message<threadsafe::yes> playing { this, "playing", "Is Live's transport is running?",
+    message<threadsafe::yes> playing { this, "playing", "Is Live's transport is running? Ignored when the transport is itm.",
         MIN_FUNCTION {
+            if(transport == transport_modes::itm) return {};
             s_live_set.set_is_playing(args[0]);
-            notify_all(this, notefication_type::playing_changed);
+            s_bus.notify(this, notefication_type::playing_changed);
             return {};
         }  
     };
 
     // Set the tempo of the Live Set
-    message<threadsafe::yes> tempo { this, "tempo", "Set the tempo of the Live Set.",
+    message<threadsafe::yes> tempo { this, "tempo", "Set the tempo of the Live Set. Ignored when the transport is itm.",
         MIN_FUNCTION {
+            if(transport == transport_modes::itm) return {};
             s_live_set.set_tempo(args[0]);
             return {};
         }  
     };
 
-    message<> getLiveClock { this, "getLiveClock", "Get the Live Clock",
+    // Set the time signature of the Live Set
+    message<threadsafe::yes> time_signature { this, "time_signature", "Set the time signature of the Live Set. Ignored when the transport is itm. Args: numerator, denominator",
         MIN_FUNCTION {
-            c74::max::t_itm* clock_source = (c74::max::t_itm*) c74::max::itm_getnamed(c74::max::gensym("live"), nullptr, nullptr, 1L);
+            if(transport == transport_modes::itm) return {};
+            if(args.size() != 2) {
+                cerr << "Error: time_signature message requires two arguments: numerator and denominator." << endl;
+                return {};
+            }
+            s_live_set.set_time_signature(args[0], args[1]);
+            return {};
+        }  
+    };
 
-            auto itm_tic = itm_getticks(clock_source);
-            double itm_tem =  itm_gettempo(clock_source);
-            auto itm_res = 480.0;
-            auto itm_bea = itm_tic / itm_res;
+    // Read the transport from the ITM, on the scheduler at the transport_interval
+    timer<> itm_poll { this,
+        MIN_FUNCTION {
+            if(transport != transport_modes::itm) return {};
+            poll_itm();
+            itm_poll.delay(transport_interval);
+            return {};
+        }
+    };
 
-            cout << "itm_tempo: " << itm_tem << " itm_ticks: " << itm_tic << " itm_beats: " << itm_bea << endl;
+    // Attribute for where the transport comes from
+    enum class transport_modes : int { messages, itm, enum_count };
+    enum_map transport_modes_range = {"messages", "itm"};
+    attribute<transport_modes> transport { this, "transport", transport_modes::messages, transport_modes_range,
+        description {"messages follows the number, tempo and playing messages from the Live observers. "
+                     "itm reads the position, tempo, transport state and time signature directly from Live's ITM, every transport_interval ms."},
+        setter {MIN_FUNCTION {
+            transport_modes mode = static_cast<transport_modes>(static_cast<int>(args[0]));
+            if(mode == transport_modes::itm) itm_poll.delay(0);
+            else                             itm_poll.stop();
+            return args;
+        }}
+    };
+
+    attribute<double> transport_interval {this, "transport_interval", 2.0,
+        description {"How often the ITM is read in ms, when the transport is itm."},
+        range {1.0, 100.0}
+    };
+
+    // Read the ITM and follow it
+    void poll_itm() {
+        drain_input();
+        if(!m_itm.read()) return;
+        follow_itm(m_itm);
+    }
+
+    // Follow a read of the ITM like the number, tempo, playing and time_signature messages would
+    void follow_itm(const ItmTransport& itm) {
+        s_live_set.set_tempo(itm.tempo);
+        s_live_set.set_time_signature(itm.numerator, itm.denominator);
+        if(itm.playing != s_live_set.get_is_playing()) {
+            s_live_set.set_is_playing(itm.playing);
+            s_bus.notify(this, notefication_type::playing_changed);
+        }
+
+        // Only tick when the position has moved, like the observer only sends number when it changes, 
+        // or when a new chord track waits for the next tick
+        if(itm.beats == m_itm_beats && s_chord_track_version.load() == s_chord_track_ticked) return;
+        m_itm_beats = itm.beats;
+
+        // The clock owner follows the clock for all instances
+        if(!is_clock_owner()) return;
+        clock_tick(itm.beats);
+    }
+
+    message<> getLiveClock { this, "getLiveClock", "Get the Live Clock",
+        MIN_FUNCTION {
+            ItmTransport itm;
+            if(!itm.read()) {
+                cerr << "Error: getLiveClock could not find the live ITM." << endl;
+                return {};
+            }
+
+            cout << "itm_tempo: " << itm.tempo << " itm_beats: " << itm.beats << " itm_playing: " << itm.playing 
+                 << " itm_time_signature: " << itm.numerator << "/" << itm.denominator << endl;
 
             return {};
         }
@@ -386,30 +1449,138 @@ public:
     message<> set_chord { this, "set_chord", "Input the Chord, format: 'C7', 'C7 0 4 F7 4 12 B 12 16'",
         MIN_FUNCTION {
             
-            s_chord.setChord(args[0]);
-            s_pitch_vector = s_chord.getNotes().getPitch();
+            set_current_chord(&ChordCache::get(static_cast<std::string>(args[0])));
+            // The chord is not from the chord track, the next tick compares the chord track with the current chord again
+            s_current_chord_index = -2;
+
+            // cout << current_chord()->name << " - " << current_chord()->chord.getNotes() << endl;
+
+            s_bus.notify(this, notefication_type::chord_changed);
+
+            return {};
+        }
+    };
 
-            // cout << s_chord.toString() << " - " << s_chord.getNotes() << endl;
+    attribute<int, threadsafe::yes> detect_chords {this, "detect_chords", 0,
+        description {"Recognise the chord of the notes that are held at the note inlet, e.g. from a keyboard player, and make it the current chord."},
+        range {0, 1}
+    };
 
-            notify_all(this, notefication_type::chord_changed);
+    attribute<double, threadsafe::yes> detect_hold {this, "detect_hold", 60.0,
+        description {"How long a recognised chord must stay the best match before it becomes the current chord, in ms. "
+                     "Bounds the latency of the chord detection, and keeps it from flapping while a chord is played."},
+        range {0.0, 1000.0}
+    };
 
+    // Check the recognised chord again when the hold time has passed, if no other note arrives before that
+    timer<> detect_timer { this,
+        MIN_FUNCTION {
+            detect_chord();
             return {};
         }
     };
 
+    // Publish the chord of the held notes, when it has been recognised for the hold time
+    void detect_chord() {
+        const double now = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        const int chord = m_recogniser.update(now, detect_hold);
+        if(m_recogniser.pending()) detect_timer.delay(detect_hold);
+        if(chord < 0) return;
+
+        set_current_chord(&ChordCache::get(ChordRecogniser::symbol(chord)));
+        // The chord is not from the chord track, the next tick compares the chord track with the current chord again
+        s_current_chord_index = -2;
+        s_bus.notify(this, notefication_type::chord_changed);
+    }
+
     // Set ChordTrack
     message<> set_chord_track { this, "set_chord_track", "Input the ChordTrack, format: 'C7 0 4 F7 4 12 B 12 16', Chord, StartTime, EndTime",
         MIN_FUNCTION {
-            s_chord_track.from_atoms(args);
+            if(args.size() / 3 > ChordTrack::c_max_chords) {
+                cerr << "Error: set_chord_track message has more than " << ChordTrack::c_max_chords << " chords." << endl;
+                return {};
+            }
 
-            cout << s_chord_track << endl;
+            auto track = std::make_shared<ChordTrack>();
+            track->from_atoms(args);
+            publish_chord_track(track);
+            return {};
+        }  
+    };
 
-            number(s_beats < 0 ? 0 : static_cast<double>(s_beats + 0.0001));
+    // Insert chords into the ChordTrack
+    message<> insert_chords { this, "insert_chords", "Insert chords into the ChordTrack, format: 'C7 0 4 F7 4 12', Chord, StartTime, EndTime",
+        MIN_FUNCTION {
+            if(args.size() < 3 || args.size() % 3 != 0) {
+                cerr << "Error: insert_chords message requires chords as triplets: chord, start time, end time." << endl;
+                return {};
+            }
+
+            const auto playing = get_chord_track();
+            if(playing->size() + args.size() / 3 > ChordTrack::c_max_chords) {
+                cerr << "Error: insert_chords message would make the ChordTrack longer than " << ChordTrack::c_max_chords << " chords." << endl;
+                return {};
+            }
 
+            auto track = std::make_shared<ChordTrack>(*playing);
+            track->insert_atoms(args);
+            publish_chord_track(track);
             return {};
-        }  
+        }
+    };
+
+    // Replace the chords in a range of the ChordTrack
+    message<> replace_chords { this, "replace_chords", "Replace the chords starting in a time range, format: 'StartTime EndTime C7 0 4 F7 4 12'",
+        MIN_FUNCTION {
+            if(args.size() < 2 || (args.size() - 2) % 3 != 0) {
+                cerr << "Error: replace_chords message requires a start time, an end time and chords as triplets: chord, start time, end time." << endl;
+                return {};
+            }
+
+            auto track = std::make_shared<ChordTrack>(*get_chord_track());
+            track->remove_chords(args[0], args[1]);
+            if(track->size() + (args.size() - 2) / 3 > ChordTrack::c_max_chords) {
+                cerr << "Error: replace_chords message would make the ChordTrack longer than " << ChordTrack::c_max_chords << " chords." << endl;
+                return {};
+            }
+            track->insert_atoms(args, 2);
+            publish_chord_track(track);
+            return {};
+        }
     };
 
+    // Remove the chords in a range of the ChordTrack
+    message<> remove_chords { this, "remove_chords", "Remove the chords starting in a time range, format: 'StartTime EndTime'",
+        MIN_FUNCTION {
+            if(args.size() != 2) {
+                cerr << "Error: remove_chords message requires two arguments: start time and end time." << endl;
+                return {};
+            }
+
+            auto track = std::make_shared<ChordTrack>(*get_chord_track());
+            if(track->remove_chords(args[0], args[1]) == 0) return {};
+            publish_chord_track(track);
+            return {};
+        }
+    };
+
+    attribute<int> print_chord_track {this, "print_chord_track", 0,
+        description {"Print the ChordTrack to the Max console whenever it changes. Slow for long songs."},
+        range {0, 1}
+    };
+
+    // The ChordTrack that is playing. Edits are made to a copy that is swapped in, so the scheduler never waits for them.
+    // The copy is made by the edit message on the main thread, and costs at most c_max_chords chords.
+    static std::shared_ptr<const ChordTrack> get_chord_track() { return std::atomic_load(&s_chord_track); }
+
+    // The indices of the new track are not those of the old, so the clock owner starts over on its next tick
+    void publish_chord_track(std::shared_ptr<const ChordTrack> track) {
+        std::atomic_store(&s_chord_track, track);
+        s_chord_track_version++;
+
+        if(print_chord_track == 1) cout << *track << endl;
+    }
+
 
 
 
@@ -444,6 +1615,15 @@ public:
         }}
     };
 
+    // Attribute for how the played chord changes
+    enum class voicing_modes : int { retrigger, diff, nearest, enum_count };
+    enum_map voicing_modes_range = {"retrigger", "diff", "nearest"};
+    attribute<voicing_modes> voicing { this, "voicing", voicing_modes::retrigger, voicing_modes_range,
+        description {"How the played chord changes, when play_chord is on. retrigger stops all chord tones and plays the new chord. "
+                     "diff only stops the tones that are not in the new chord and only plays the new tones. "
+                     "nearest moves every chord tone to the nearest tone of the new chord, and adds the tones no tone moved to."}
+    };
+
     // pitch_min, picth_max
     attribute<int, threadsafe::yes> pitch_min {this, "pitch_min", 0,
         description {"Minimum pitch allowed."},
@@ -462,29 +1642,150 @@ public:
     };
 
 
+    // Does the instance shift the time of the chord changes, by a latency or an offset. Set by the setters of the two 
+    // attributes, which run before both attributes are constructed.
+    bool m_has_latency = false;
+    bool m_has_offset  = false;
+
     // Attribute to offset the beats time from the Live Set
     attribute<double> offset {this, "offset", 0.0,
-        description {"Offset the beats time from the Live Set."},
+        description {"Offset the beats time from the Live Set for this instance, in beats. A positive offset plays the chord changes later."},
         range {-1.0, 1.0},  // Define a range for the parameter
         setter {MIN_FUNCTION {
+            m_has_offset = static_cast<double>(args[0]) != 0.0;
+            update_tick_subscription();
+            return args;
+        }}
+    };
+
+    // Attribute for how the spring parameters are sent to the UI
+    enum class spring_sync_modes : int { full, delta, enum_count };
+    enum_map spring_sync_modes_range = {"full", "delta"};
+    attribute<spring_sync_modes, threadsafe::yes> spring_sync { this, "spring_sync", spring_sync_modes::full, spring_sync_modes_range,
+        description {"full sends every parameter of the selected spring as a separate message. "
+                     "delta sends only the parameters that changed since the last sync, as one springs params message."}
+    };
+
+    attribute<int> seed {this, "seed", 0,
+        description {"Seed for the random velocities and pitches, reapplied when the transport starts. 0 seeds differently every time."}
+    };
+
+    attribute<double, threadsafe::yes> latency {this, "latency", 0.0,
+        description {"The latency of the instrument in ms. Chord changes are notified and played this much ahead."},
+        range {0.0, 1000.0},  // Define a range for the parameter
+        setter {MIN_FUNCTION {
+            m_has_latency = static_cast<double>(args[0]) > 0.0;
+            update_tick_subscription();
             return args;
         }}
     };
 
+    // Look ahead on every tick only when there is a latency or an offset
+    void update_tick_subscription() {
+        if(m_has_latency || m_has_offset) s_bus.subscribe(this, notefication_type::tick);
+        else                              s_bus.unsubscribe(this, notefication_type::tick);
+    }
+
+    // How far ahead of the clock this instance plays the chord changes, in beats
+    double time_shift() const {
+        return (m_has_latency ? s_live_set.ms_to_beats(latency) : 0.0) - (m_has_offset ? static_cast<double>(offset) : 0.0);
+    }
 
-    // Notify all instances of a change
-    static void notify_all(repitch* notifying_instance, notefication_type type) {
-        for (auto instance : s_instances) instance->notify(notifying_instance, type);
+    // Subscribe to the beats and bars only while a spring resets its arp on them. Checked after the input is drained,
+    // as an arp only moves when its spring is triggered, which is drained too.
+    void update_arp_subscriptions() {
+        const long version = Springs::paramVersion();
+        if(version == m_arp_version) return;
+        m_arp_version = version;
+
+        bool needs_beats, needs_bars;
+        m_springs.arpResets(needs_beats, needs_bars);
+        if(needs_beats) s_bus.subscribe(this, notefication_type::beat);
+        else            s_bus.unsubscribe(this, notefication_type::beat);
+        if(needs_bars)  s_bus.subscribe(this, notefication_type::bar);
+        else            s_bus.unsubscribe(this, notefication_type::bar);
+    }
+
+    // Set the playing position and detect a chord change, once for all instances
+    void clock_tick(double beats) {
+        s_live_set.set_beats(beats);
+
+        // A new chord track was published, the chord at this tick is compared with the current chord
+        const long track_version = s_chord_track_version.load();
+        if(track_version != s_chord_track_ticked) {
+            s_chord_track_ticked = track_version;
+            s_chord_cursor = ChordTrack::Cursor();
+            s_current_chord_index = -2;
+        }
+
+        // Get the index of the chord at the new time, using the cursor from the last tick
+        const auto track = get_chord_track();
+        int new_index = track->get_chord_index_at_time(s_live_set.get_beats(), s_chord_cursor);
+
+        // Only when the index changes, we compare the chords themselves
+        if(new_index != s_current_chord_index) {
+            s_current_chord_index = new_index;
+            const auto& new_chord = track->get_chord(new_index);
+
+            // If the chord has changed. An edit that only moved the end of the chord does not change it.
+            const bool changed = !new_chord.isSameChord(s_current_chord);
+            s_current_chord = new_chord;
+            if(changed) {
+                set_current_chord(&new_chord.entry());
+                s_bus.notify(this, notefication_type::chord_changed);
+            }
+        }
+
+        // Notify when the transport crosses a beat or a bar, for the arp resets
+        const long beat = s_live_set.get_beat_index();
+        if(beat != s_beat_index) {
+            const long bar = s_live_set.get_bar_index();
+            const bool is_bar = bar != s_bar_index;
+            s_beat_index = beat;
+            s_bar_index = bar;
+            s_bus.notify(this, is_bar ? notefication_type::bar : notefication_type::beat);
+        }
+
+        // Let the instances with latency look ahead
+        s_bus.notify(this, notefication_type::tick);
+    }
+
+    // Is this instance the clock owner? The first instance to tick becomes the owner, and another instance takes 
+    // over when the owner is deleted or has stopped ticking.
+    bool is_clock_owner() {
+        const long long now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        repitch* owner = s_clock_owner.load();
+        if(owner != this) {
+            if(owner != nullptr && now - s_clock_owner_ticked.load() < c_clock_timeout_ms) return false;
+            if(!s_clock_owner.compare_exchange_strong(owner, this)) return false;
+        }
+        s_clock_owner_ticked.store(now);
+        return true;
     }
 
     // Notify this instance of a change. Pass the type of change as an argument and also the instance that is notifying.
+    // The change is queued, so the voices and the springs are only changed where the input is drained.
     void notify(repitch* notifying_instance, notefication_type type) {
+        post_input(InputEvent::types::notification, static_cast<int>(type), 0);
+    }
+
+    // Handle a queued notification
+    void handle_notification(notefication_type type) {
         switch (type) {
             case notefication_type::chord_changed: 
-                chord_changed(notifying_instance);
+                chord_changed();
             break;
             case notefication_type::playing_changed:
-                playing_changed(notifying_instance);
+                playing_changed();
+            break;
+            case notefication_type::tick:
+                tick();
+            break;
+            case notefication_type::beat:
+                m_springs.beatChanged(false);
+            break;
+            case notefication_type::bar:
+                m_springs.beatChanged(true);
             break;
             case notefication_type::enum_count:
             break;
@@ -492,25 +1793,91 @@ public:
     }
 
     // Notification function for chord_changed
-    void chord_changed(repitch* notifying_instance)
+    void chord_changed()
+    {
+        follow_chord_track();
+
+        // With a latency or an offset, the chords of the track are played by tick at the shifted time
+        if((m_has_latency || m_has_offset) && s_live_set.get_is_playing() && s_current_chord_index >= 0) return;
+
+        m_chord_played = s_current_chord;
+        chord_changed_at(s_current_chord_index, current_chord());
+    }
+
+    // Notification function for tick, the chord at the time shifted by the latency and the offset may change
+    void tick()
+    {
+        if(!(m_has_latency || m_has_offset) || !s_live_set.get_is_playing()) return;
+        follow_chord_track();
+
+        const double beats = s_live_set.get_beats() + time_shift();
+        const auto track = get_chord_track();
+        const int index = track->get_chord_index_at_time(beats, m_chord_cursor);
+        if(index < 0 || index == m_chord_index_played) return;
+
+        m_chord_played = track->get_chord(index);
+        chord_changed_at(index, &m_chord_played.entry());
+    }
+
+    // After the clock owner has started over on a new chord track, the chord this instance played is found in the new
+    // track, so an edit elsewhere in the track does not play it again
+    void follow_chord_track()
+    {
+        if(m_chord_track_ticked == s_chord_track_ticked) return;
+        m_chord_track_ticked = s_chord_track_ticked;
+        m_chord_cursor = ChordTrack::Cursor();
+        if(m_chord_index_played < 0) return;
+
+        const int index = get_chord_track()->find_chord(m_chord_played);
+        m_chord_index_played = index >= 0 ? index : -2;
+    }
+
+    // Play the chord and notify that the chord has changed
+    void chord_changed_at(int index, const ChordCache::Entry* chord)
     {
+        m_chord_index_played = index;
+
         if(play_chord == 1) {
-            playChord(0);
-            if(s_live_set.get_is_playing()){
-                playChord(100);
+            if(voicing == voicing_modes::retrigger || !s_live_set.get_is_playing()) {
+                playChord(0);
+                if(s_live_set.get_is_playing()){
+                    playChord(100, chord);
+                }
+            }
+            else {
+                changeChord(100, chord);
             }
         }
 
         // Reset all the spring arps
-        m_springs.chordChanged();
+        m_springs.chordChanged(chord);
 
         // Send a bang to the second outlet to notify that the chord has changed
         out2.send("bang");
     }
 
+    // Get the chord that is current after a latency in ms and the offset of the instance, so a late instrument can be 
+    // triggered early
+    const ChordCache::Entry* get_chord_ahead(double latency_ms, ChordTrack::Cursor& cursor) const
+    {
+        const double shift = s_live_set.ms_to_beats(std::max(latency_ms, 0.0)) - (m_has_offset ? static_cast<double>(offset) : 0.0);
+        if(shift == 0.0 || !s_live_set.get_is_playing()) return current_chord();
+
+        const double beats = s_live_set.get_beats() + shift;
+        const auto track = get_chord_track();
+        const int index = track->get_chord_index_at_time(beats, cursor);
+        if(index < 0) return current_chord();
+        return &track->get_chord(index).entry();
+    }
+
     // Notification function for playing_changed
-    void playing_changed(repitch* notifying_instance)
+    void playing_changed()
     {
+        // Every run starts the random sequences from the seed
+        if(s_live_set.get_is_playing()) reseed();
+
+        m_chord_index_played = s_current_chord_index;
+        m_chord_played = s_current_chord;
         if(s_live_set.get_is_playing() && play_chord == 1){
             playChord(100);
         }
@@ -520,7 +1887,7 @@ public:
     }
 
     // playChord
-    void playChord(int velocity) {
+    void playChord(int velocity, const ChordCache::Entry* chord = current_chord()) {
         // Note Off
         if(velocity==0)
         {
@@ -529,18 +1896,92 @@ public:
         }
 
         // Note On
-        for(auto pitch : s_pitch_vector){
+        for(auto pitch : chord->pitches){
             pitch = pitchToRange(pitch);
             noteOn(-1, pitch, velocity);
         }
     }
 
+    // Change the playing chord to another chord, only stopping and starting the tones that differ
+    void changeChord(int velocity, const ChordCache::Entry* chord) {
+        std::vector<int> playing;
+        for(int pitch_out=0; pitch_out<128; pitch_out++) {
+            if(m_voices.getPitchIn(pitch_out) == VoiceTable::c_chord) playing.push_back(pitch_out);
+        }
+
+        std::array<bool, 128> target {};
+        if(voicing == voicing_modes::nearest && !playing.empty()) {
+            for(auto pitch : nearestVoicing(playing, chord->quant_table.mask(), pitch_min, pitch_max)) target[pitch] = true;
+        }
+        else {
+            for(auto pitch : chord->pitches) {
+                pitch = pitchToRange(pitch);
+                if(VoiceTable::isValidPitch(pitch)) target[pitch] = true;
+            }
+        }
+
+        // Note offs first, so the budget has voices for the note ons
+        for(auto pitch : playing) {
+            if(!target[pitch]) stopVoice(pitch);
+        }
+        for(int pitch=0; pitch<128; pitch++) {
+            if(target[pitch] && m_voices.getPitchIn(pitch) != VoiceTable::c_chord) noteOn(VoiceTable::c_chord, pitch, velocity);
+        }
+    }
+
+    // Move every voice to the nearest pitch of a chord, given as a pitch class mask, between low and high. Common tones
+    // stay, and the tones of the chord that no voice moved to are added in range.
+    static std::vector<int> nearestVoicing(const std::vector<int>& voices, int mask, int low, int high) {
+        std::array<bool, 128> taken {};
+        int covered = 0;
+        std::vector<int> pitches;
+        auto take = [&](int pitch) {
+            taken[pitch] = true;
+            covered |= 1 << (pitch % 12);
+            pitches.push_back(pitch);
+        };
+        auto in_range = [&](int pitch) { return pitch >= low && pitch <= high && VoiceTable::isValidPitch(pitch); };
+
+        // The common tones stay
+        std::vector<int> moving;
+        for(auto pitch : voices) {
+            if(mask & (1 << (pitch % 12))) take(pitch);
+            else moving.push_back(pitch);
+        }
+
+        // The others move to the nearest free tone, a tone that is not played yet first
+        for(auto pitch : moving) {
+            int best = -1;
+            for(int pass=0; pass<2 && best<0; pass++) {
+                const int wanted = pass == 0 ? mask & ~covered : mask;
+                for(int distance=1; distance<12 && best<0; distance++) {
+                    for(int candidate : {pitch - distance, pitch + distance}) {
+                        if(in_range(candidate) && !taken[candidate] && (wanted & (1 << (candidate % 12)))) { best = candidate; break; }
+                    }
+                }
+            }
+            if(best >= 0) take(best);
+        }
+
+        // Add the tones that no voice moved to
+        for(int pitch_class=0; pitch_class<12; pitch_class++) {
+            if(!(mask & ~covered & (1 << pitch_class))) continue;
+            int pitch = pitches.empty() ? low : pitches.front();
+            pitch += ((pitch_class - pitch % 12) + 12) % 12;
+            while(pitch > high) pitch -= 12;
+            while(pitch < low) pitch += 12;
+            if(in_range(pitch) && !taken[pitch]) take(pitch);
+        }
+        return pitches;
+    }
+
     // Get the chord as a string
     message<threadsafe::yes> get_chord {this, "get_chord", "Return the chord symbol.",
         MIN_FUNCTION {
+            const auto* chord = current_chord();
             atoms res;
             res.push_back("chord");
-            res.push_back(s_chord.toString());
+            res.push_back(chord->name);
 
             out1.send(res);
 
@@ -551,11 +1992,12 @@ public:
     // Get the pitch vector from the chord
     message<threadsafe::yes> get_pitch_vector {this, "get_pitch_vector", "Return the midinotes of the chord tones.",
         MIN_FUNCTION {
+            const auto* chord = current_chord();
             atoms res;
             res.push_back("pitch_vector");
             
             if(args.size() == 1) {
-                for(auto pitch : s_pitch_vector){
+                for(auto pitch : chord->pitches){
                     int octave = args[0];
                     int transpose =  (octave * 12 + cmtk::C0) - cmtk::C3;
                     pitch = pitchToRange(pitch + transpose);
@@ -565,13 +2007,13 @@ public:
             else if(args.size() == 2 && static_cast<int>(args[1]) - static_cast<int>(args[0]) >= 11) {
                 int low = args[0];
                 int high = args[1];
-                for(auto pitch : s_pitch_vector){
+                for(auto pitch : chord->pitches){
                     pitch = pitchToRange(pitch, low, high);
                     res.push_back(pitch);
                 }
             }
             else {            
-                for(auto pitch : s_pitch_vector) {
+                for(auto pitch : chord->pitches) {
                     pitch = pitchToRange(pitch);
                     res.push_back(pitch);
                 }
@@ -586,15 +2028,16 @@ public:
     // Get the Root of the chord
     message<threadsafe::yes> get_root {this, "get_root", "Return the root of the chord.",
         MIN_FUNCTION {
+            const auto* chord = current_chord();
             int pitch = -1;
 
             if( (args.size() == 2) && (static_cast<int>(args[1])-static_cast<int>(args[0]) >= 11) ) {
                 int low = args[0];
                 int high = args[1];
-                pitch = s_chord.getRoot(low,high).getPitch();
+                pitch = chord->chord.getRoot(low,high).getPitch();
             }
             else {
-                pitch = s_chord.getRoot().getPitch();
+                pitch = chord->root;
             }
 
             pitch = pitchToRange(pitch);
@@ -608,15 +2051,16 @@ public:
     // Get the Bass of the chord
     message<threadsafe::yes> get_bass {this, "get_bass", "Return the bass of the chord.",
         MIN_FUNCTION {
+            const auto* chord = current_chord();
             int pitch = -1;
 
             if(args.size() == 2 && static_cast<int>(args[1]) - static_cast<int>(args[0]) >= 11) {
                 int low = args[0];
                 int high = args[1];
-                pitch = s_chord.getBass(low,high).getPitch();
+                pitch = chord->chord.getBass(low,high).getPitch();
             }
             else {
-                pitch = s_chord.getBass().getPitch();
+                pitch = chord->bass;
             }
 
             pitch = pitchToRange(pitch);
@@ -627,28 +2071,26 @@ public:
         } 
     };
 
-    // Get the Random pitch from the chord
+    // Get the Random pitch from the chord. The random generator is only used where the input is drained.
     message<threadsafe::yes> get_rand {this, "get_rand", "Return a random pitch from the chord.",
         MIN_FUNCTION {
-            int pitch = -1;
-            atom res;
-
             if(args.size() == 2 && static_cast<int>(args[1]) - static_cast<int>(args[0]) >= 11) {
-                int low = args[0];
-                int high = args[1];
-                pitch = s_chord.getRandNote(low, high).getPitch();
+                post_input(InputEvent::types::random_pitch, static_cast<int>(args[0]), static_cast<int>(args[1]));
             }
             else {
-                pitch = s_chord.getRandNote().getPitch();
+                post_input(InputEvent::types::random_pitch, 0, -1);
             }
-
-            res = pitchToRange(pitch);
-            out1.send(res);
-            
             return {};
         } 
     };
 
+    // Output a random pitch of the chord between low and high, or of the whole chord when high is below low
+    void send_random_pitch(int low, int high) {
+        const auto* chord = current_chord();
+        const int pitch = low <= high ? chord->random_pitch(m_random, low, high) : chord->random_pitch(m_random);
+        out1.send(pitchToRange(pitch));
+    }
+
     int pitchToRange(int pitch){
         while(pitch < pitch_min) pitch += 12;
         while(pitch > pitch_max) pitch -= 12;
@@ -668,6 +2110,7 @@ public:
     // Get Pitch At
     message<threadsafe::yes> noteAt {this, "noteAt", "Return the pitch at the given index.",
         MIN_FUNCTION {
+            const auto* chord = current_chord();
 
             int pitch = -1;
             int low = pitch_min;
@@ -684,17 +2127,20 @@ public:
                 case message_type::float_argument:
                 {
                     int index = args[0];
-                    pitch = s_chord.getNoteAt(index).getPitch();
+                    pitch = chord->chord.getNoteAt(index).getPitch();
                     pitch = pitchToRange(pitch, low, high);
                 }
                 break;
                 case message_type::symbol_argument:{
                     std::string str = args[0];
-                    if     (str == "root") pitch = s_chord.getRoot().getPitch();
-                    else if(str == "bass") pitch = s_chord.getBass().getPitch();
-                    else if(str == "high") pitch = s_chord.getNotes().back().getPitch();
-                    else if(str == "low" ) pitch = s_chord.getNotes().front().getPitch();
-                    else if(str == "rand") pitch = s_chord.getRandNote(pitch_min, pitch_max).getPitch();
+                    if     (str == "root") pitch = chord->root;
+                    else if(str == "bass") pitch = chord->bass;
+                    else if(str == "high") pitch = chord->high;
+                    else if(str == "low" ) pitch = chord->low;
+                    else if(str == "rand") {
+                        post_input(InputEvent::types::random_pitch, pitch_min, pitch_max);
+                        return {};
+                    }
                     else {
                         cerr << "noteAt message requires a valid index: index, 'r (root)' or '(b) bass'." << endl;
                         return {};
@@ -723,11 +2169,14 @@ public:
                 return {};
             }
 
+            // Quantize the whole list to the same chord
+            const auto* chord = current_chord();
+
             atoms res;
             res.push_back("quantized");
             for (const auto& arg : args) {
                 int pitch_in = arg;
-                int pitch_out = find_nearest_pitch(pitch_in);
+                int pitch_out = find_nearest_pitch(pitch_in, chord);
                 pitch_out = pitchToRange(pitch_out);
                 res.push_back(pitch_out);
             }
@@ -750,79 +2199,199 @@ public:
             int pitch_in = args[0];
             int velocity = args[1];
 
-            // Check that the velocity is between 0 and 127
+            // Check that the pitch and the velocity are between 0 and 127
+            if(!VoiceTable::isValidPitch(pitch_in)) {
+                cout << "Error: pitch must be between 0 and 127." << endl;
+                return {};
+            }
             if(velocity < 0 || velocity > 127) {
                 cout << "Error: velocity must be between 0 and 127." << endl;
                 return {};
             }
 
-            if(velocity == 0) 
-            {
-                noteOff(pitch_in);
-            }
-            else 
-            {
-                int pitch_out = pitch_in;
+            // Handle the note on the thread that owns the voices
+            post_input(InputEvent::types::note, pitch_in, velocity);
 
-                switch(note_mode) {
-                    case note_modes::pass:{ 
-                    }
-                    break;
-                    case note_modes::quantize:{ 
-                        pitch_out = find_nearest_pitch(pitch_in); 
-                    } 
-                    break; 
-                    case note_modes::step:{ 
-                        auto index = pitch_in-60;
-                        pitch_out = s_chord.getNoteAt(index).getPitch();
-                    } 
-                    break;
-                    case note_modes::enum_count: 
-                    break;
-                }
+            return {};
+        }
+    };
+
+    // Repitch a note and play it, on the thread that drains the input queue
+    void handleNote(int pitch_in, int velocity)
+    {
+        // Follow the chord that is played. The held notes are always kept, so detection can be turned on at any time.
+        if(velocity == 0) m_recogniser.noteOff(pitch_in);
+        else              m_recogniser.noteOn(pitch_in);
+        if(detect_chords == 1) detect_chord();
+
+        const auto* chord = current_chord();
+
+        if(velocity == 0) 
+        {
+            noteOff(pitch_in);
+        }
+        else 
+        {
+            int pitch_out = pitch_in;
 
-                // Make Note On
-                noteOn(pitch_in, pitch_out, velocity);
+            switch(note_mode) {
+                case note_modes::pass:{ 
+                }
+                break;
+                case note_modes::quantize:{ 
+                    pitch_out = find_nearest_pitch(pitch_in, chord); 
+                } 
+                break; 
+                case note_modes::step:{ 
+                    auto index = pitch_in-60;
+                    pitch_out = chord->chord.getNoteAt(index).getPitch();
+                } 
+                break;
+                case note_modes::enum_count: 
+                break;
             }
 
-            return {};
+            // Make Note On
+            noteOn(pitch_in, pitch_out, velocity);
         }
-    };
+    }
 
     void noteOff(int pitch_in)
     {
-        // Check if a note with the same pitch_in is already playing, if so, send noteoff and remove the note from the set
-        auto it = std::remove_if(playing_notes.begin(), playing_notes.end(), [pitch_in, this](const Note& note) {
-            const bool should_remove = note.m_pitch_in == pitch_in;
-            if(should_remove) this->out1.send("note", note.m_pitch_out, 0);
-            return should_remove;
-        });
-        playing_notes.erase(it, playing_notes.end());
+        // The chord voices are all stopped together
+        if(pitch_in == VoiceTable::c_chord) {
+            for(int pitch_out=0; pitch_out<128; pitch_out++) {
+                if(m_voices.getPitchIn(pitch_out) == VoiceTable::c_chord) stopVoice(pitch_out);
+            }
+            return;
+        }
+
+        // Stop the voice the input pitch is playing
+        if(!VoiceTable::isValidPitch(pitch_in)) return;
+        const int pitch_out = m_voices.getPitchOut(pitch_in);
+        if(pitch_out != VoiceTable::c_none) stopVoice(pitch_out);
     }
 
     void noteOn(int pitch_in, int pitch_out, int velocity)
     {
         // Get the pitch in range
         pitch_out = pitchToRange(pitch_out);
+        if(!VoiceTable::isValidPitch(pitch_out)) return;
+
+        // If the output pitch is already playing, or the input pitch is playing another pitch, send noteoff first
+        if(m_voices.isPlaying(pitch_out)) stopVoice(pitch_out);
+        if(VoiceTable::isValidPitch(pitch_in)) {
+            const int playing = m_voices.getPitchOut(pitch_in);
+            if(playing != VoiceTable::c_none) stopVoice(playing);
+        }
 
-        // Check if a note with the same pitch_in is already playing, if so, send noteoff and remove the note from the set
-        auto it = std::remove_if(playing_notes.begin(), playing_notes.end(), [pitch_in, pitch_out, this](const Note& note) {
-            const bool should_remove = (note.m_pitch_out == pitch_out) || (note.m_pitch_in >= 0 && note.m_pitch_in == pitch_in);
-            if(should_remove) this->out1.send("note", note.m_pitch_out, 0);
-            return should_remove;
-        });
-        playing_notes.erase(it, playing_notes.end());
-        
-        // Create a new note
-        Note new_note = Note(pitch_in, pitch_out, velocity);
+        // The instrument may not have a voice left for it
+        if(!claimVoice(pitch_out, velocity)) return;
 
         // Send a noteon message
-        out1.send("note", new_note.m_pitch_out, new_note.m_velocity);
+        out1.send("note", pitch_out, velocity);
+        m_voices.start(pitch_in, pitch_out, velocity);
+    }
+
+    void stopVoice(int pitch_out)
+    {
+        out1.send("note", pitch_out, 0);
+        m_voices.stop(pitch_out);
+        releaseVoice(pitch_out);
+    }
+
+    // Claim a voice of the instrument in the budget. When it takes the place of another note, that note is stopped.
+    bool claimVoice(int pitch_out, int velocity)
+    {
+        const int inst = voice_inst;
+        if(!VoiceBudget::isValidInst(inst)) return true;
+
+        VoiceBudget::Voice voice;
+        voice.owner    = m_voice_owner;
+        voice.pitch    = pitch_out;
+        voice.velocity = velocity;
+        voice.priority = voice_priority;
+
+        VoiceBudget::Voice stolen;
+        if(!s_voice_budget.claim(inst, voice, voice_steal, stolen)) return false;
+        m_voice_insts[pitch_out] = inst;
+
+        // The owner stops the stolen note on its own thread. The lock keeps the owner from being deleted meanwhile.
+        if(stolen.isValid()) {
+            std::lock_guard<std::mutex> lock(s_instances_mutex);
+            for(auto instance : s_instances) {
+                if(instance->m_voice_owner == stolen.owner) instance->post_input(InputEvent::types::stolen, stolen.pitch, inst);
+            }
+        }
+        return true;
+    }
+
+    // Give a voice back to the budget
+    void releaseVoice(int pitch_out)
+    {
+        if(m_voice_insts[pitch_out] == 0) return;
+        s_voice_budget.release(m_voice_insts[pitch_out], m_voice_owner, pitch_out);
+        m_voice_insts[pitch_out] = 0;
+    }
 
-        // Add the note to the set of playing notes
-        playing_notes.push_back(new_note);
+    // Stop a note whose voice was taken by another note, the voice is not ours to give back.
+    // If the pitch was played again since, it has a new voice and keeps playing.
+    void stopStolenVoice(int pitch_out, int inst)
+    {
+        if(!VoiceTable::isValidPitch(pitch_out) || m_voice_insts[pitch_out] != inst) return;
+        if(s_voice_budget.holds(inst, m_voice_owner, pitch_out)) return;
+        m_voice_insts[pitch_out] = 0;
+        if(!m_voices.isPlaying(pitch_out)) return;
+        out1.send("note", pitch_out, 0);
+        m_voices.stop(pitch_out);
     }
 
+    attribute<int, threadsafe::yes> voice_inst {this, "voice_inst", 0,
+        description {"The instrument this instance plays, in the voice budget that all instances share. 0 plays without a budget."},
+        range {0, VoiceBudget::c_num_insts}
+    };
+
+    attribute<int, threadsafe::yes> voice_priority {this, "voice_priority", 64,
+        description {"The priority of the notes of this instance in the voice budget, for voice_steal lowest_priority."},
+        range {0, 127}
+    };
+
+    enum_map voice_steal_range = {"none", "oldest", "quietest", "lowest_priority"};
+    attribute<VoiceBudget::steal_modes, threadsafe::yes> voice_steal { this, "voice_steal", VoiceBudget::steal_modes::oldest, voice_steal_range,
+        description {"What happens to a note when the instrument has no free voice. none does not play it, otherwise it takes the voice "
+                     "of the oldest note, the quietest note or the note with the lowest priority, if that is not higher than its own."}
+    };
+
+    // Set the number of voices of an instrument
+    message<threadsafe::yes> set_voice_budget {this, "set_voice_budget", "Set the number of voices of an instrument, shared by all instances that play it. args: inst, voices (0 for no limit)",
+        MIN_FUNCTION {
+            if(args.size() != 2) {
+                cerr << "Error: set_voice_budget message requires two arguments: inst and voices." << endl;
+                return {};
+            }
+            int inst = args[0];
+            if(!VoiceBudget::isValidInst(inst)) {
+                cerr << "Error: set_voice_budget requires an inst between 1 and " << VoiceBudget::c_num_insts << "." << endl;
+                return {};
+            }
+            s_voice_budget.setVoices(inst, args[1]);
+            return {};
+        }
+    };
+
+    // Get the voices of an instrument
+    message<threadsafe::yes> get_voice_budget {this, "get_voice_budget", "Output the number of voices of an instrument, and how many are playing. args: inst",
+        MIN_FUNCTION {
+            if(args.size() != 1) {
+                cerr << "Error: get_voice_budget message requires one argument: inst." << endl;
+                return {};
+            }
+            int inst = args[0];
+            out1.send("voice_budget", inst, s_voice_budget.getVoices(inst), s_voice_budget.getActive(inst));
+            return {};
+        }
+    };
+
     // Get value from the dictionary
     message<threadsafe::yes> get_springs_param {this, "get_springs_param", "Get a value from the dictionary.",
         MIN_FUNCTION {
@@ -831,9 +2400,7 @@ public:
                 return {};
             }
 
-            atoms res = m_springs.param_dict[symbol(args[0])];
-            out1.send(res);
-
+            post_input(InputEvent::types::springs_param, 0, 0, args[0]);
             return {};
         }
     };
@@ -846,25 +2413,15 @@ public:
                 return {};
             }
 
-            const auto& spring = m_springs.getSpring(args[0]);
-            out1.send("springs", "param", "midinote"           , spring.midinote);
-            out1.send("springs", "param", "inst"               , spring.inst);
-            out1.send("springs", "param", "mode"               , spring.mode);
-            out1.send("springs", "param", "note"               , spring.note);
-            out1.send("springs", "param", "transpose"          , spring.transpose);
-            out1.send("springs", "param", "pitch_min"          , spring.pitch_min);
-            out1.send("springs", "param", "pitch_max"          , spring.pitch_max);
-            out1.send("springs", "param", "octave_add"         , spring.octave_add);
-            out1.send("springs", "param", "velocity"           , spring.velocity);
-            out1.send("springs", "param", "velocity_deviation" , spring.velocity_deviation);
-            out1.send("springs", "param", "duration"           , spring.duration);
-            out1.send("springs", "param", "arp_style"          , spring.arp.getStyle());
-            out1.send("springs", "param", "arp_steps"          , spring.arp.getSteps());
-            out1.send("springs", "param", "arp_jump"           , spring.arp.getJump());
-            out1.send("springs", "param", "arp_octaves"        , spring.arp.getOctaves());
-            out1.send("springs", "param", "arp_reset"     , spring.arp_reset);
-
+            post_input(InputEvent::types::spring_params, static_cast<int>(args[0]), 0);
+            return {};
+        }
+    };
 
+    // Dump all springs into one dict
+    message<> dump_springs {this, "dump_springs", "Output a dict with the parameters of all springs, one entry per spring, in the order of the params entry.",
+        MIN_FUNCTION {
+            post_input(InputEvent::types::dump_springs, 0, 0);
             return {};
         }
     };
@@ -877,9 +2434,18 @@ public:
                 return {};
             }
 
-            std::string index = args[0];
-            std::string param = args[1];
-            std::string key = index + "-" + param;
+            int index = args[0];
+            std::string param_name = args[1];
+            auto param = Springs::param_from_name(param_name);
+
+            if(!Springs::isValidIndex(index)) {
+                cerr << "Error: set_springs_param requires a spring index between 0 and " << Springs::c_num_springs - 1 << "." << endl;
+                return {};
+            }
+            if(param == Springs::spring_params::enum_count) {
+                cerr << "Error: Unknown spring parameter: " << param_name << endl;
+                return {};
+            }
 
             // Add the rest of the arguments to value, skipping the first 2 arguments
             switch(args[2].type())
@@ -888,12 +2454,12 @@ public:
                 case message_type::float_argument:
                 {
                     int value = args[2];
-                    m_springs.param_dict[symbol(key)] = value;
+                    post_input(InputEvent::types::spring_param, index, static_cast<int>(param), value);
                 }
                 break;
                 case message_type::symbol_argument:{
                     symbol value = args[2];
-                    m_springs.param_dict[symbol(key)] = value;
+                    post_input(InputEvent::types::spring_param, index, static_cast<int>(param), value);
                 }
                 break;
                 default:
@@ -905,6 +2471,96 @@ public:
         }
     };
 
+    // Reload the springs from the dictionary
+    message<threadsafe::yes> reload_springs {this, "reload_springs", "Read the springs from the dictionary again, after it was changed by other means than set_springs_param.",
+        MIN_FUNCTION {
+            Springs::reload();
+            return {};
+        }
+    };
+
+    // Load a bank of springs from a named dict
+    message<> load_bank { this, "load_bank", "Load a bank of springs from a named dict, to recall it later. args: bank name, dict name",
+        MIN_FUNCTION {
+            if(args.size() != 2) {
+                cerr << "Error: load_bank message requires two arguments: bank name and dict name." << endl;
+                return {};
+            }
+
+            std::string name = args[0];
+            symbol dict_name = args[1];
+            c74::max::t_dictionary* d = c74::max::dictobj_findregistered_retain(dict_name);
+            if(!d) {
+                cerr << "Error: load_bank could not find the dict: " << dict_name << endl;
+                return {};
+            }
+            Springs::loadBank(name, d);
+            c74::max::dictobj_release(d);
+
+            out1.send("springs", "bank", "loaded", symbol(name));
+            return {};
+        }
+    };
+
+    // Read a bank of springs from a JSON file
+    message<> read_bank { this, "read_bank", "Read a bank of springs from a JSON file, e.g. springs_default_params.txt, to recall it later. args: bank name, absolute file path",
+        MIN_FUNCTION {
+            if(args.size() != 2) {
+                cerr << "Error: read_bank message requires two arguments: bank name and file path." << endl;
+                return {};
+            }
+
+            std::string name = args[0];
+            std::string file_path = args[1];
+            char filename[c74::max::MAX_FILENAME_CHARS] = {0};
+            short path_id = 0;
+            if(c74::max::path_frompathname(file_path.c_str(), &path_id, filename) != 0) {
+                cerr << "Error: read_bank could not find the file: " << file_path << endl;
+                return {};
+            }
+            c74::max::t_dictionary* d = nullptr;
+            if(c74::max::dictionary_read(filename, path_id, &d) != 0 || !d) {
+                cerr << "Error: read_bank could not read the file: " << file_path << endl;
+                return {};
+            }
+            Springs::loadBank(name, d);
+            c74::max::object_free(d);
+
+            out1.send("springs", "bank", "loaded", symbol(name));
+            return {};
+        }
+    };
+
+    // Recall a bank of springs
+    message<> recall_bank { this, "recall_bank", "Switch all instances to a loaded bank of springs at once. args: bank name",
+        MIN_FUNCTION {
+            if(args.size() != 1) {
+                cerr << "Error: recall_bank message requires one argument: bank name." << endl;
+                return {};
+            }
+
+            std::string name = args[0];
+            if(!m_springs.recallBank(name)) {
+                cerr << "Error: recall_bank could not find the bank: " << name << endl;
+                return {};
+            }
+
+            // Show the selected spring of the new bank
+            get_spring_params(m_springs.current_spring.load());
+            return {};
+        }
+    };
+
+    // List the loaded banks
+    message<> get_banks { this, "get_banks", "Output the names of the loaded banks of springs.",
+        MIN_FUNCTION {
+            atoms res = {"springs", "banks"};
+            for(const auto& name : Springs::bankNames()) res.push_back(symbol(name));
+            out1.send(res);
+            return {};
+        }
+    };
+
     // Select Spring
     message<threadsafe::yes> select_spring {this, "select_spring", "Select the spring to edit.",
         MIN_FUNCTION {
@@ -913,9 +2569,9 @@ public:
                 return {};
             }
 
-            m_springs.current_spring = args[0];
+            m_springs.current_spring = static_cast<int>(args[0]);
 
-            get_spring_params(m_springs.current_spring);
+            get_spring_params(m_springs.current_spring.load());
 
             return {};
         }
@@ -931,7 +2587,7 @@ public:
 
             atoms myArgs;
             // Spring Index
-            myArgs.push_back(m_springs.current_spring);
+            myArgs.push_back(m_springs.current_spring.load());
             // Add the rest of the arguments
             for(auto& arg : args) myArgs.push_back(arg);
             // Call the set_springs_param function
@@ -941,9 +2597,26 @@ public:
         }
     };
 
-    void outSpringNote(const Springs::Spring& spring, int pitch)
+    void outSpringNote(Springs::Spring& spring, int pitch)
     {
-        out1.send("springs", "makenote", pitch, spring.getVelocity(), spring.duration, spring.inst);
+        if(spring_alloc == Springs::alloc_modes::off) {
+            out1.send("springs", "makenote", pitch, spring.getVelocity(), spring.duration, spring.inst);
+            return;
+        }
+
+        // Let a free spring of the same instrument play the note, and tell which one
+        const double now = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto& actuator = m_springs.allocate(spring.index, pitch, spring_alloc, now);
+        out1.send("springs", "makenote", pitch, actuator.getVelocity(), actuator.duration, actuator.inst, actuator.index);
+    };
+
+    // Attribute for how triggers are routed to the springs of an instrument
+    enum_map spring_alloc_range = {"off", "round_robin", "least_recent", "nearest_pitch"};
+    attribute<Springs::alloc_modes, threadsafe::yes> spring_alloc { this, "spring_alloc", Springs::alloc_modes::off, spring_alloc_range,
+        description {"off plays every trigger on the spring it was sent to. "
+                     "Otherwise a trigger is played by a spring of the same inst that is not busy with a note or its recovery, "
+                     "chosen in turn (round_robin), the one that played longest ago (least_recent) or the one that played the nearest pitch (nearest_pitch). "
+                     "The index of the spring that plays is added to the makenote message."}
     };
 
     // SpringTrig
@@ -954,151 +2627,306 @@ public:
                 return {};
             }
 
-            auto& spring = m_springs.getSpring(args[0]);
-            std::vector<int> pitch;
-
-            // Find the pitch according to the mode
-            if     (spring.mode == "midinote") pitch.push_back(spring.note);
-            else if(spring.mode == "quantize") pitch.push_back(find_nearest_pitch(spring.note)); 
-            else if(spring.mode == "step")     pitch.push_back(s_chord.getNoteAt(spring.note-60).getPitch());
-            else if(spring.mode == "root")     pitch.push_back(s_chord.getRoot().getPitch());
-            else if(spring.mode == "bass")     pitch.push_back(s_chord.getBass().getPitch());
-            else if(spring.mode == "high")     pitch.push_back(s_chord.getNotes().back().getPitch());
-            else if(spring.mode == "low" )     pitch.push_back(s_chord.getNotes().front().getPitch());
-            else if(spring.mode == "rand")     pitch.push_back(s_chord.getRandNote(spring.pitch_min, spring.pitch_max).getPitch());
-            else if(spring.mode == "arp")      pitch.push_back(spring.arp.next(s_chord));
-            else if(spring.mode == "chord")    pitch = s_chord.getNotes().getPitch();
-            else {
-                cerr << "Error: Unknown mode: " << spring.mode << endl;
+            int index = args[0];
+            if(!Springs::isValidIndex(index)) {
+                cerr << "Error: springTrig requires a spring index between 0 and " << Springs::c_num_springs - 1 << "." << endl;
                 return {};
             }
 
-            // Make the notes
-            for(auto p : pitch) {
-                // Transpose the pitch
-                p += spring.transpose;
+            // Trigger the spring on the thread that owns the springs
+            post_input(InputEvent::types::spring, index, 0);
+
+            return {};
+        }
+    };
+
+    // Trigger a spring, on the thread that drains the input queue
+    void triggerSpring(int index)
+    {
+        auto& spring = m_springs.getSpring(index);
+        std::vector<int> pitch;
+
+        // The chord that is current when the spring strikes
+        const auto* chord = get_chord_ahead(spring.latency, spring.cursor);
+
+        // Find the pitch according to the mode
+        using spring_modes = Springs::spring_modes;
+        switch(spring.mode) {
+            case spring_modes::midinote: pitch.push_back(spring.note); break;
+            case spring_modes::quantize: pitch.push_back(find_nearest_pitch(spring.note, chord)); break;
+            case spring_modes::step:     pitch.push_back(chord->chord.getNoteAt(spring.note-60).getPitch()); break;
+            case spring_modes::root:     pitch.push_back(chord->root); break;
+            case spring_modes::bass:     pitch.push_back(chord->bass); break;
+            case spring_modes::high:     pitch.push_back(chord->high); break;
+            case spring_modes::low:      pitch.push_back(chord->low); break;
+            case spring_modes::rand:     pitch.push_back(chord->random_pitch(spring.random, spring.pitch_min, spring.pitch_max)); break;
+            case spring_modes::arp:      pitch.push_back(spring.nextArp(chord)); break;
+            case spring_modes::chord:    pitch = chord->pitches; break;
+            case spring_modes::enum_count:
+                cerr << "Error: Unknown mode: " << spring.mode_name << endl;
+                return;
+        }
+
+        // Make the notes
+        for(auto p : pitch) {
+            // Transpose the pitch
+            p += spring.transpose;
+
+            // Get the pitch in range
+            while(p < spring.pitch_min) p += 12;
+            while(p > spring.pitch_max) p -= 12;
 
-                // Get the pitch in range
-                while(p < spring.pitch_min) p += 12;
-                while(p > spring.pitch_max) p -= 12;
+            // MakeNote
+            outSpringNote(spring, p);
 
-                // MakeNote
+            // If octave_add is set, make a new note
+            if(spring.octave_add != 0) {
+                p += spring.octave_add * 12;
                 outSpringNote(spring, p);
+            }
+        }
+    }
 
-                // If octave_add is set, make a new note
-                if(spring.octave_add != 0) {
-                    p += spring.octave_add * 12;
-                    outSpringNote(spring, p);
-                }
+    // A note, a spring trigger, a note whose voice was stolen, a notification, an edit of the springs or a request for
+    // the springs or a random pitch, waiting in the input queue
+    struct InputEvent {
+        enum class types : int { note, spring, stolen, notification, spring_param, spring_params, dump_springs, springs_param, random_pitch };
+        types type;
+        int value1;
+        int value2;
+        atom value;
+    };
+    static constexpr size_t c_input_queue_size = 1024;
+
+    // Queue an input event, from any thread. The input_timer drains the queue right away, unless the ITM poll comes first.
+    void post_input(InputEvent::types type, int value1, int value2, const atom& value = atom()) {
+        if(!m_input.push({type, value1, value2, value})) {
+            m_input_dropped++;
+            return;
+        }
+        if(!m_input_scheduled.exchange(true)) input_timer.delay(0);
+    }
+
+    // Handle the queued input events in order. Only the input_timer and the ITM poll drain, both on the scheduler,
+    // so the queue has one consumer and the voices and the springs are only changed from there.
+    void drain_input() {
+        m_input_scheduled.store(false);
+        InputEvent event;
+        while(m_input.pop(event)) {
+            switch(event.type) {
+                case InputEvent::types::note:   handleNote(event.value1, event.value2); break;
+                case InputEvent::types::spring: triggerSpring(event.value1); break;
+                case InputEvent::types::stolen: stopStolenVoice(event.value1, event.value2); break;
+                case InputEvent::types::notification:  handle_notification(static_cast<notefication_type>(event.value1)); break;
+                case InputEvent::types::spring_param:  m_springs.setParam(event.value1, static_cast<Springs::spring_params>(event.value2), event.value); break;
+                case InputEvent::types::spring_params: send_spring_params(event.value1); break;
+                case InputEvent::types::dump_springs:  send_springs_dump(); break;
+                case InputEvent::types::springs_param: send_springs_param(event.value); break;
+                case InputEvent::types::random_pitch:  send_random_pitch(event.value1, event.value2); break;
             }
+        }
+
+        update_arp_subscriptions();
+
+        const int dropped = m_input_dropped.exchange(0);
+        if(dropped > 0) cerr << "Error: the input queue was full, " << dropped << " input events were dropped." << endl;
+    }
 
+    timer<> input_timer { this,
+        MIN_FUNCTION {
+            drain_input();
             return {};
         }
     };
 
+    // Output the parameters of a spring, only those that changed when the spring sync is delta
+    void send_spring_params(int index) {
+        if(spring_sync == spring_sync_modes::delta) {
+            atoms changed = m_springs.getChangedParams(index);
+            if(changed.empty()) return;
+            atoms res = {"springs", "params"};
+            res.insert(res.end(), changed.begin(), changed.end());
+            out1.send(res);
+            return;
+        }
+
+        // Deltas start from a complete sync again, when switching to delta
+        m_springs.resetSync();
+
+        const auto& spring = m_springs.getSpring(index);
+        out1.send("springs", "param", "midinote"           , spring.midinote);
+        out1.send("springs", "param", "inst"               , spring.inst);
+        out1.send("springs", "param", "mode"               , spring.mode_name);
+        out1.send("springs", "param", "note"               , spring.note);
+        out1.send("springs", "param", "transpose"          , spring.transpose);
+        out1.send("springs", "param", "pitch_min"          , spring.pitch_min);
+        out1.send("springs", "param", "pitch_max"          , spring.pitch_max);
+        out1.send("springs", "param", "octave_add"         , spring.octave_add);
+        out1.send("springs", "param", "velocity"           , spring.velocity);
+        out1.send("springs", "param", "velocity_deviation" , spring.velocity_deviation);
+        out1.send("springs", "param", "duration"           , spring.duration);
+        out1.send("springs", "param", "arp_style"          , spring.arp.getStyle());
+        out1.send("springs", "param", "arp_steps"          , spring.arp.getSteps());
+        out1.send("springs", "param", "arp_jump"           , spring.arp.getJump());
+        out1.send("springs", "param", "arp_octaves"        , spring.arp.getOctaves());
+        out1.send("springs", "param", "arp_reset"          , spring.arp_reset);
+        out1.send("springs", "param", "latency"            , spring.latency);
+        out1.send("springs", "param", "recovery"           , spring.recovery);
+    }
 
+    // Output a dict with the parameters of all springs
+    void send_springs_dump() {
+        atoms names;
+        for(int param=0; param<Springs::c_num_params; param++) names.push_back(symbol(Springs::paramName(param)));
+        m_springs_dump.clear();
+        m_springs_dump[symbol("params")] = names;
+        for(int index=0; index<Springs::c_num_springs; index++) {
+            m_springs_dump[symbol(std::to_string(index))] = m_springs.getParams(index);
+        }
+        out1.send("springs", "dump", "dictionary", m_springs_dump.name());
+    }
 
-private:
+    // Output a value of the springs param dict
+    void send_springs_param(const symbol& key) {
+        atoms res = m_springs.param_dict[key];
+        out1.send(res);
+    }
 
-    // Check if a pitch is in the chord
-    bool is_pitch_in_chord(int pitch){
-        int p = pitch;
+    // The transport of the Live Set that all instances follow
+    static const LiveSet& live_set() { return s_live_set; }
 
-        // If p is in picth_vector, return true
-        if(cmtk::contains(s_pitch_vector,p)) return true;
+private:
 
-        // Check octaves below
-        p = pitch - 12;
-        while(p >= 0)
-        {
-            if(cmtk::contains(s_pitch_vector,p)) return true;
-            p -= 12;
-        }
+    // Seed the random generators of the instance and its springs from the seed attribute
+    void reseed() {
+        int a_seed = seed;
+        uint64_t value = a_seed != 0 ? static_cast<uint64_t>(a_seed) : (static_cast<uint64_t>(std::random_device()()) << 32) | std::random_device()();
+        m_random.seed(value);
+        m_springs.seed(value + 1);
+    }
 
-        // Check octaves above
-        p = pitch + 12;
-        while(p < 128)
-        {
-            if(cmtk::contains(s_pitch_vector,p)) return true;
-            p += 12;
-        }
-        
-        // If no allowed pitch is found, return false
-        return false;
+    // Get the current chord
+    static const ChordCache::Entry* current_chord() { return s_chord.load(std::memory_order_acquire); }
+
+    // Set the current chord, and publish it to the harmonic context of the package
+    static void set_current_chord(const ChordCache::Entry* chord) {
+        s_chord.store(chord, std::memory_order_release);
+        HarmonicContext::publish(chord->quant_table.mask());
     }
 
     // Find the nearest pitch in the chord
-   int find_nearest_pitch(int pitch){
-        
-        if(is_pitch_in_chord(pitch)) return pitch;
-
-        // Find the nearest pitch
-        for(int i=1; i<7; i++) {
-            if(is_pitch_in_chord(pitch - i)){
-                return pitch - i;
-            }
-            if(is_pitch_in_chord(pitch + i)){
-                return pitch + i;
-            }
-        }
-        
+    int find_nearest_pitch(int pitch, const ChordCache::Entry* chord = current_chord()){
         // If no pitch is found, post an error and return the pitch
-        cerr << "Error: No allowed pitch found for pitch " << pitch << endl;
-        return pitch;
+        if(chord->quant_table.empty()) {
+            cerr << "Error: No allowed pitch found for pitch " << pitch << endl;
+            return pitch;
+        }
+
+        return chord->quant_table.nearest(pitch);
     }
     
-    // List of all playing notes
-    std::vector<Note> playing_notes = {};
+    // The playing notes
+    VoiceTable m_voices;
+    // The instrument in the voice budget every output pitch has claimed a voice of, 0 for none
+    std::array<int, 128> m_voice_insts {};
+    // This instance in the voice budget
+    int m_voice_owner = static_cast<int>(s_next_voice_owner.fetch_add(1) % 0xFFFF) + 1;
+
+    // The chord looked up ahead by the latency, and the index of the last chord this instance reacted to
+    ChordTrack::Cursor m_chord_cursor;
+    int m_chord_index_played = -2;
+    ChordTrack::TimedChord m_chord_played;
+    long m_chord_track_ticked = 0;
+
+    // The version of the springs the beat and bar subscriptions were made for
+    long m_arp_version = -1;
 
     // Static list of all instances of the class
+    static std::mutex s_instances_mutex;
     static std::set<repitch*> s_instances;
+
+    // The notifications the instances have subscribed to
+    static NotificationBus<repitch, notefication_type> s_bus;
+
+    // The voices of the instruments, shared by all instances
+    static VoiceBudget s_voice_budget;
+    static std::atomic<unsigned> s_next_voice_owner;
+
+    // The instance that follows the clock, and when it last ticked in ms
+    static std::atomic<repitch*> s_clock_owner;
+    static std::atomic<long long> s_clock_owner_ticked;
+
+    // The beat and the bar at the last tick
+    static long s_beat_index;
+    static long s_bar_index;
+    static constexpr long long c_clock_timeout_ms = 250;
     
     // Static ChordTrack
-    static ChordTrack s_chord_track;
+    static std::shared_ptr<const ChordTrack> s_chord_track;
+    // Counts the published chord tracks, and the count the clock owner has started over on
+    static std::atomic<long> s_chord_track_version;
+    static long s_chord_track_ticked;
+    static ChordTrack::Cursor s_chord_cursor;
+    static int s_current_chord_index;
     static ChordTrack::TimedChord s_current_chord;
-    static cmtk::Chord s_chord;
-    static std::vector<int> s_pitch_vector;
-
+    // The current chord. Entries are interned and never freed, so a reader on any thread gets a consistent chord.
+    static std::atomic<const ChordCache::Entry*> s_chord;
 
 
-    // Static Beat
-    static double s_beats;
-
     // A structure to hold information about the live set
     static LiveSet s_live_set;
 
     // Instrumets
     Springs m_springs = Springs();
+    // The dict that dump_springs fills
+    dict m_springs_dump = dict(symbol("springs-dump-dict"));
 
+    // The random generator for get_rand and noteAt, only used where the input is drained
+    Random m_random;
 
-};
+    // Recognises the chord of the incoming notes, when detect_chords is on
+    ChordRecogniser m_recogniser;
 
+    // The notes and spring triggers from any thread, handled in order on the scheduler
+    MpscQueue<InputEvent, c_input_queue_size> m_input;
+    std::atomic<int> m_input_dropped {0};
+    std::atomic<bool> m_input_scheduled {false};
 
-// The implementation of the constructor for the note class ...
-// The order of initialization is critical
-Note::Note(int a_pitch_in, int a_pitch_out, int a_velocity)
-    : m_pitch_in {a_pitch_in}
-    , m_pitch_out {a_pitch_out}
-    , m_velocity {a_velocity}
-    , m_id {++s_counter}
-{
-}
+    // The ITM, and the position that was read from it last
+    ItmTransport m_itm;
+    double m_itm_beats = -1.0;
+
+
+};
 
 
 // Init Static variables
+std::mutex repitch::s_instances_mutex;
 std::set<repitch*> repitch::s_instances = {};
-
-long Note::s_counter = 0;
+NotificationBus<repitch, repitch::notefication_type> repitch::s_bus;
+VoiceBudget repitch::s_voice_budget;
+std::atomic<unsigned> repitch::s_next_voice_owner {0};
+std::atomic<repitch*> repitch::s_clock_owner {nullptr};
+std::atomic<long long> repitch::s_clock_owner_ticked {0};
+long repitch::s_beat_index = -1;
+long repitch::s_bar_index = -1;
+std::atomic<long> Springs::s_param_version {0};
+std::atomic<long> Springs::s_spring_versions[Springs::c_num_springs];
+std::mutex Springs::s_banks_mutex;
+std::map<std::string, std::shared_ptr<const Springs::Bank>> Springs::s_banks = {};
+std::shared_ptr<const Springs::Recall> Springs::s_recall = nullptr;
 
 // Init ChordTrack
-ChordTrack repitch::s_chord_track = ChordTrack();
+std::shared_ptr<const ChordTrack> repitch::s_chord_track = std::make_shared<const ChordTrack>();
+std::atomic<long> repitch::s_chord_track_version {0};
+long repitch::s_chord_track_ticked = 0;
+ChordTrack::Cursor repitch::s_chord_cursor = ChordTrack::Cursor();
+int repitch::s_current_chord_index = -2;
 ChordTrack::TimedChord repitch::s_current_chord = ChordTrack::TimedChord();
-cmtk::Chord repitch::s_chord = cmtk::Chord("Fm");
-std::vector<int> repitch::s_pitch_vector = {};
+std::atomic<const ChordCache::Entry*> repitch::s_chord {&ChordCache::get("Fm")};
 
 
 // Init Static Beat
-double repitch::s_beats = -1.0;
 LiveSet repitch::s_live_set = LiveSet();
 
 
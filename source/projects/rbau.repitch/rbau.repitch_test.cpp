@@ -5,6 +5,10 @@
 
 #include "c74_min_unittest.h"     // required unit test header
 #include "rbau.repitch.cpp"    // need the source of our object so that we can access it
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <thread>
 
 // Unit tests are written using the Catch framework as described at
 // https://github.com/philsquared/Catch/blob/master/docs/tutorial.md
@@ -19,3 +23,1117 @@ SCENARIO("object produces correct output") {
 
     }
 }
+
+
+// The search that was used before the quantisation table, kept as the reference
+static int nearest_pitch_by_search(const std::vector<int>& pitch_vector, int pitch) {
+    auto contains = [&pitch_vector](int p) { return std::find(pitch_vector.begin(), pitch_vector.end(), p) != pitch_vector.end(); };
+    auto in_chord = [&contains](int pitch) {
+        if(contains(pitch)) return true;
+        for(int p = pitch - 12; p >= 0; p -= 12) if(contains(p)) return true;
+        for(int p = pitch + 12; p < 128; p += 12) if(contains(p)) return true;
+        return false;
+    };
+    if(in_chord(pitch)) return pitch;
+    for(int i=1; i<7; i++) {
+        if(in_chord(pitch - i)) return pitch - i;
+        if(in_chord(pitch + i)) return pitch + i;
+    }
+    return pitch;
+}
+
+SCENARIO("the quantisation table gives the same pitches as searching the chord") {
+
+    GIVEN("Some chords as pitch vectors") {
+        std::vector<std::vector<int>> chords = {
+            {65, 68, 72},            // Fm
+            {60, 64, 67, 70},        // C7
+            {47, 62, 65, 69, 72},    // Dm7/B
+            {61},                    // A single pitch
+            {60, 62, 64, 66, 68, 70} // Whole tone
+        };
+
+        THEN("every pitch is quantised to the same pitch") {
+            for(const auto& chord : chords) {
+                QuantTable table(chord);
+                for(int pitch=-12; pitch<140; pitch++) {
+                    REQUIRE(table.nearest(pitch) == nearest_pitch_by_search(chord, pitch));
+                }
+            }
+        }
+    }
+}
+
+// A benchmark of the table against the search. Hidden, as a timing is no pass or fail: run it with the [.benchmark] tag.
+SCENARIO("the quantisation table is measured against searching the chord", "[.benchmark]") {
+
+    GIVEN("Some chords as pitch vectors and their tables") {
+        std::vector<std::vector<int>> chords = {
+            {65, 68, 72},            // Fm
+            {60, 64, 67, 70},        // C7
+            {47, 62, 65, 69, 72},    // Dm7/B
+            {61},                    // A single pitch
+            {60, 62, 64, 66, 68, 70} // Whole tone
+        };
+        std::vector<QuantTable> tables(chords.begin(), chords.end());
+
+        THEN("both are timed for every pitch of every chord") {
+            using steady = std::chrono::steady_clock;
+            const int rounds = 200;
+            long sum_search = 0;
+            long sum_table = 0;
+
+            auto start = steady::now();
+            for(int r=0; r<rounds; r++) {
+                for(const auto& chord : chords) {
+                    for(int pitch=0; pitch<128; pitch++) sum_search += nearest_pitch_by_search(chord, pitch);
+                }
+            }
+            auto search_time = steady::now() - start;
+
+            start = steady::now();
+            for(int r=0; r<rounds; r++) {
+                for(const auto& table : tables) {
+                    for(int pitch=0; pitch<128; pitch++) sum_table += table.nearest(pitch);
+                }
+            }
+            auto table_time = steady::now() - start;
+
+            std::cout << "quantise search: " << std::chrono::duration<double, std::micro>(search_time).count() << " us, "
+                      << "table: " << std::chrono::duration<double, std::micro>(table_time).count() << " us" << std::endl;
+
+            // The sums also keep the loops from being optimised away
+            REQUIRE(sum_table == sum_search);
+        }
+    }
+}
+
+SCENARIO("chords are interned by chord symbol") {
+
+    GIVEN("A chord track that repeats the same chords") {
+        ChordTrack track;
+        track.add_chord("Fm", 0, 4);
+        track.add_chord("Db", 4, 8);
+        track.add_chord("Fm", 8, 12);
+        track.add_chord("Db", 12, 16);
+
+        THEN("repeated chords share one entry") {
+            REQUIRE(track.get_chord_at_time(1).m_chord_id == track.get_chord_at_time(9).m_chord_id);
+            REQUIRE(track.get_chord_at_time(5).m_chord_id == track.get_chord_at_time(13).m_chord_id);
+            REQUIRE(track.get_chord_at_time(1).m_chord_id != track.get_chord_at_time(5).m_chord_id);
+            REQUIRE(&track.get_chord_at_time(1).entry() == &ChordCache::get("Fm"));
+        }
+    }
+}
+
+SCENARIO("the chord track cursor steps forward and seeks after a jump") {
+
+    GIVEN("A chord track with a chord every beat") {
+        ChordTrack track;
+        for(int beat=0; beat<32; beat++) track.add_chord(beat % 2 ? "Db" : "Fm", beat, beat + 1);
+        ChordTrack::Cursor cursor;
+
+        THEN("a time before the first chord has no chord") {
+            REQUIRE(track.get_chord_index_at_time(-1.0, cursor) == -1);
+            REQUIRE(cursor.index == -1);
+        }
+
+        WHEN("the time moves forward in small steps") {
+            THEN("the cursor follows the chord at every time") {
+                for(double time=0.0; time<32.0; time+=0.25) {
+                    const int index = track.get_chord_index_at_time(time, cursor);
+                    REQUIRE(index == static_cast<int>(time));
+                    REQUIRE(cursor.index == index);
+                }
+            }
+        }
+
+        WHEN("the time jumps further ahead than the cursor steps") {
+            track.get_chord_index_at_time(2.5, cursor);
+
+            THEN("the cursor seeks to the chord") {
+                REQUIRE(track.get_chord_index_at_time(20.5, cursor) == 20);
+                REQUIRE(cursor.index == 20);
+            }
+        }
+
+        WHEN("the time jumps back") {
+            track.get_chord_index_at_time(20.5, cursor);
+
+            THEN("the cursor seeks back to the chord") {
+                REQUIRE(track.get_chord_index_at_time(3.5, cursor) == 3);
+                REQUIRE(track.get_chord_index_at_time(4.0, cursor) == 4);
+            }
+        }
+
+        WHEN("the cursor is past the end of a shorter track") {
+            cursor.index = 100;
+
+            THEN("the cursor seeks instead of reading past the end") {
+                REQUIRE(track.get_chord_index_at_time(40.0, cursor) == 31);
+            }
+        }
+    }
+}
+
+SCENARIO("chords are inserted and removed by time range") {
+
+    GIVEN("A chord track with three chords") {
+        ChordTrack track;
+        track.insert_chord("Fm", 8, 12);
+        track.insert_chord("Fm", 0, 4);
+        track.insert_chord("Db", 4, 8);
+
+        THEN("the chords are sorted by start time") {
+            REQUIRE(track.size() == 3);
+            REQUIRE(track.get_chord(0).m_start == 0);
+            REQUIRE(track.get_chord(1).m_start == 4);
+            REQUIRE(track.get_chord(2).m_start == 8);
+        }
+
+        WHEN("a range without chords is removed") {
+            THEN("nothing is removed") {
+                REQUIRE(track.remove_chords(12, 16) == 0);
+                REQUIRE(track.size() == 3);
+            }
+        }
+
+        WHEN("the middle range is replaced") {
+            REQUIRE(track.remove_chords(4, 8) == 1);
+            track.insert_chord("Eb", 4, 6);
+            track.insert_chord("Ab", 6, 8);
+
+            THEN("the chords around it are kept") {
+                REQUIRE(track.size() == 4);
+                REQUIRE(&track.get_chord_at_time(1).entry() == &ChordCache::get("Fm"));
+                REQUIRE(&track.get_chord_at_time(5).entry() == &ChordCache::get("Eb"));
+                REQUIRE(&track.get_chord_at_time(7).entry() == &ChordCache::get("Ab"));
+                REQUIRE(&track.get_chord_at_time(9).entry() == &ChordCache::get("Fm"));
+            }
+        }
+
+        WHEN("a copy is edited before a chord") {
+            const ChordTrack::TimedChord last = track.get_chord(track.size() - 1);
+            ChordTrack edited(track);
+            edited.remove_chords(0, 4);
+            edited.insert_chord("Db", 8, 16);
+
+            THEN("the chord is found at its new index, and the track it was copied from is unchanged") {
+                REQUIRE(edited.find_chord(last) == edited.size() - 2);
+                REQUIRE(track.find_chord(last) == track.size() - 1);
+                REQUIRE(edited.find_chord(ChordTrack::TimedChord("Eb", 8, 12)) == -1);
+                REQUIRE(ChordTrack::TimedChord("Fm", 8, 16).isSameChord(last));
+            }
+        }
+    }
+}
+
+SCENARIO("the voice table maps input pitches to output pitches") {
+
+    GIVEN("A voice table with a repitched note and a chord voice") {
+        VoiceTable voices;
+        voices.start(61, 60, 100);
+        voices.start(VoiceTable::c_chord, 64, 90);
+
+        THEN("both output pitches are playing") {
+            REQUIRE(voices.isPlaying(60));
+            REQUIRE(voices.isPlaying(64));
+            REQUIRE(voices.getPitchOut(61) == 60);
+            REQUIRE(voices.getPitchIn(64) == VoiceTable::c_chord);
+        }
+
+        WHEN("the output pitch of the note is stopped") {
+            voices.stop(60);
+            THEN("the input pitch no longer plays it") {
+                REQUIRE(!voices.isPlaying(60));
+                REQUIRE(voices.getPitchOut(61) == VoiceTable::c_none);
+                REQUIRE(voices.isPlaying(64));
+            }
+        }
+    }
+}
+
+SCENARIO("triggers are routed to the free springs of an instrument") {
+
+    GIVEN("Three springs on the same instrument, busy for 150 ms after a note") {
+        Springs springs;
+        for(int i=0; i<Springs::c_num_springs; i++) springs.getSpring(i).inst = 0;
+        for(int i=1; i<=3; i++) {
+            springs.getSpring(i).inst = 1;
+            springs.getSpring(i).duration = 100;
+            springs.getSpring(i).recovery = 50;
+        }
+        using alloc_modes = Springs::alloc_modes;
+
+        WHEN("the first spring is triggered repeatedly in round robin") {
+            THEN("the notes go to the free springs in turn, and to the one that is free first when all are busy") {
+                REQUIRE(springs.allocate(1, 60, alloc_modes::round_robin, 1000).index == 1);
+                REQUIRE(springs.allocate(1, 60, alloc_modes::round_robin, 1010).index == 2);
+                REQUIRE(springs.allocate(1, 60, alloc_modes::round_robin, 1020).index == 3);
+                REQUIRE(springs.allocate(1, 60, alloc_modes::round_robin, 1030).index == 1);
+                REQUIRE(springs.allocate(1, 60, alloc_modes::off, 1040).index == 1);
+            }
+        }
+
+        WHEN("three pitches were played by the springs, and they are free again") {
+            springs.allocate(1, 60, alloc_modes::least_recent, 2000);
+            springs.allocate(1, 67, alloc_modes::least_recent, 2001);
+            springs.allocate(1, 72, alloc_modes::least_recent, 2002);
+            int played[128];
+            for(int i=1; i<=3; i++) played[springs.getSpring(i).last_pitch] = i;
+            THEN("the spring that played the nearest pitch plays") {
+                REQUIRE(springs.allocate(1, 66, alloc_modes::nearest_pitch, 3000).index == played[67]);
+                REQUIRE(springs.allocate(1, 71, alloc_modes::nearest_pitch, 3001).index == played[72]);
+                REQUIRE(springs.allocate(1, 61, alloc_modes::nearest_pitch, 3002).index == played[60]);
+            }
+        }
+    }
+}
+
+SCENARIO("a recalled bank replaces the springs of every instance") {
+    using spring_params = Springs::spring_params;
+    auto velocity_key = [](int index) { return Springs::key(index, static_cast<int>(spring_params::velocity)); };
+
+    GIVEN("A bank loaded from a dictionary, and two instances") {
+        dict bank_dict;
+        bank_dict[velocity_key(1)] = 60;
+        bank_dict[velocity_key(2)] = 70;
+        Springs::loadBank("test-bank", bank_dict);
+
+        Springs a;
+        Springs b;
+
+        WHEN("the bank is recalled, and a parameter is set after the recall") {
+            REQUIRE(a.recallBank("test-bank"));
+            THEN("the springs have the parameters of the bank") {
+                REQUIRE(a.getSpring(1).velocity == 60);
+                REQUIRE(b.getSpring(1).velocity == 60);
+                REQUIRE(b.getSpring(2).velocity == 70);
+            }
+
+            a.setParam(1, spring_params::velocity, 100);
+            THEN("the later parameter wins in every instance") {
+                REQUIRE(a.getSpring(1).velocity == 100);
+                REQUIRE(b.getSpring(1).velocity == 100);
+                REQUIRE(b.getSpring(2).velocity == 70);
+            }
+        }
+
+        WHEN("a bank that was not loaded is recalled") {
+            THEN("it fails") {
+                REQUIRE(!a.recallBank("no-such-bank"));
+            }
+        }
+    }
+}
+
+SCENARIO("the spring parameters are synced as deltas") {
+    using spring_params = Springs::spring_params;
+
+    GIVEN("A spring that has not been synced") {
+        Springs springs;
+
+        WHEN("it is synced, synced again, and a parameter is set") {
+            THEN("the first sync sends every parameter") {
+                REQUIRE(springs.getChangedParams(3).size() == 2 * Springs::c_num_params);
+            }
+            THEN("a resync sends nothing") {
+                springs.getChangedParams(3);
+                REQUIRE(springs.getChangedParams(3).empty());
+            }
+            THEN("after setting a parameter only that parameter is sent") {
+                springs.getChangedParams(3);
+                springs.setParam(3, spring_params::velocity, 101);
+                auto changed = springs.getChangedParams(3);
+                REQUIRE(changed.size() == 2);
+                REQUIRE(static_cast<std::string>(changed[0]) == "velocity");
+                REQUIRE(static_cast<int>(changed[1]) == 101);
+            }
+        }
+    }
+}
+
+SCENARIO("the arp of a spring is played from its period") {
+
+    GIVEN("A spring that arpeggiates a triad") {
+        Springs::Spring spring;
+        const auto* chord = &ChordCache::get("C");
+
+        WHEN("the arp style repeats") {
+            spring.arp.setStyle("Up");
+            spring.arp.setOctaves(1);
+            spring.prepareArp(chord);
+            THEN("the sequence is one period of the arp") {
+                REQUIRE(spring.arp_sequence.size() == 3);
+            }
+        }
+
+        WHEN("the arp style does not repeat") {
+            spring.arp.setStyle("Random");
+            spring.prepareArp(chord);
+            THEN("there is no sequence, and the arp is played live") {
+                REQUIRE(spring.arp_sequence.empty());
+            }
+        }
+    }
+}
+
+SCENARIO("the voice budget limits the voices of an instrument across instances") {
+
+    GIVEN("An instrument with two voices, played by two instances") {
+        VoiceBudget budget;
+        budget.setVoices(1, 2);
+        using steal_modes = VoiceBudget::steal_modes;
+        auto voice = [](int owner, int pitch, int velocity, int priority) {
+            VoiceBudget::Voice v;
+            v.owner = owner;
+            v.pitch = pitch;
+            v.velocity = velocity;
+            v.priority = priority;
+            return v;
+        };
+        VoiceBudget::Voice stolen;
+
+        REQUIRE(budget.claim(1, voice(1, 60, 100, 64), steal_modes::none, stolen));
+        REQUIRE(budget.claim(1, voice(2, 64, 50, 64), steal_modes::none, stolen));
+        REQUIRE(budget.getActive(1) == 2);
+
+        WHEN("a third note is played without stealing") {
+            THEN("it is not admitted") {
+                REQUIRE(!budget.claim(1, voice(1, 67, 100, 64), steal_modes::none, stolen));
+                REQUIRE(!stolen.isValid());
+            }
+        }
+
+        WHEN("a third note steals the quietest voice") {
+            THEN("the note of the other instance is stolen") {
+                REQUIRE(budget.claim(1, voice(1, 67, 100, 64), steal_modes::quietest, stolen));
+                REQUIRE(stolen.owner == 2);
+                REQUIRE(stolen.pitch == 64);
+                REQUIRE(budget.getActive(1) == 2);
+                REQUIRE(!budget.holds(1, 2, 64));
+                REQUIRE(budget.holds(1, 1, 67));
+            }
+            AND_WHEN("the stolen note is released by its owner") {
+                budget.release(1, 2, 64);
+                THEN("the voice that took its place keeps playing") {
+                    REQUIRE(budget.getActive(1) == 2);
+                }
+            }
+        }
+
+        WHEN("a note with a lower priority than all playing notes is played") {
+            THEN("it can not steal a voice") {
+                REQUIRE(!budget.claim(1, voice(2, 72, 100, 10), steal_modes::lowest_priority, stolen));
+            }
+        }
+
+        WHEN("a voice is released") {
+            budget.release(1, 1, 60);
+            THEN("a new note is admitted without stealing") {
+                REQUIRE(budget.getActive(1) == 1);
+                REQUIRE(budget.claim(1, voice(2, 72, 100, 64), steal_modes::none, stolen));
+                REQUIRE(!stolen.isValid());
+            }
+        }
+    }
+}
+
+SCENARIO("the voice budget keeps its count when voices are lowered or stolen by their owner") {
+
+    GIVEN("An instrument with three voices, all held by one instance") {
+        VoiceBudget budget;
+        budget.setVoices(1, 3);
+        using steal_modes = VoiceBudget::steal_modes;
+        auto voice = [](int pitch) {
+            VoiceBudget::Voice v;
+            v.owner = 1;
+            v.pitch = pitch;
+            v.velocity = 100;
+            return v;
+        };
+        VoiceBudget::Voice stolen;
+
+        for(int pitch : {60, 64, 67}) REQUIRE(budget.claim(1, voice(pitch), steal_modes::none, stolen));
+
+        WHEN("the voices are lowered to one while the three are held") {
+            budget.setVoices(1, 1);
+
+            THEN("the held voices keep playing, and a new note is only played by stealing") {
+                REQUIRE(budget.getActive(1) == 3);
+                REQUIRE(!budget.claim(1, voice(70), steal_modes::none, stolen));
+                REQUIRE(budget.getActive(1) == 3);
+            }
+
+            AND_WHEN("the instance steals its own oldest voice") {
+                REQUIRE(budget.claim(1, voice(72), steal_modes::oldest, stolen));
+
+                THEN("its own note is stolen and the count stays") {
+                    REQUIRE(stolen.owner == 1);
+                    REQUIRE(stolen.pitch == 60);
+                    REQUIRE(!budget.holds(1, 1, 60));
+                    REQUIRE(budget.holds(1, 1, 72));
+                    REQUIRE(budget.getActive(1) == 3);
+                }
+
+                AND_WHEN("all notes are released, the stolen one included") {
+                    for(int pitch : {60, 64, 67}) budget.release(1, 1, pitch);
+
+                    THEN("only the note that stole is counted, and no note is admitted beside it") {
+                        REQUIRE(budget.getActive(1) == 1);
+                        REQUIRE(!budget.claim(1, voice(74), steal_modes::none, stolen));
+                        budget.release(1, 1, 72);
+                        REQUIRE(budget.getActive(1) == 0);
+                        REQUIRE(budget.claim(1, voice(74), steal_modes::none, stolen));
+                    }
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("the voices of a chord move to the nearest tones of the next chord") {
+
+    GIVEN("A C major chord moving to F major and a G7 chord moving to C major") {
+        const int f_major = (1 << 5) | (1 << 9) | (1 << 0);
+        const int c_major = (1 << 0) | (1 << 4) | (1 << 7);
+
+        THEN("common tones stay and the other voices move by the smallest steps") {
+            auto to_f = repitch::nearestVoicing({60, 64, 67}, f_major, 24, 96);
+            std::sort(to_f.begin(), to_f.end());
+            REQUIRE(to_f == std::vector<int>({60, 65, 69}));
+
+            auto to_c = repitch::nearestVoicing({55, 59, 62, 65}, c_major, 24, 96);
+            std::sort(to_c.begin(), to_c.end());
+            REQUIRE(to_c == std::vector<int>({55, 60, 64, 67}));
+        }
+
+        THEN("a tone that no voice moves to is added") {
+            auto to_c = repitch::nearestVoicing({67}, c_major, 24, 96);
+            std::sort(to_c.begin(), to_c.end());
+            REQUIRE(to_c == std::vector<int>({67, 72, 76}));
+        }
+    }
+}
+
+SCENARIO("the chord of the held notes is recognised") {
+
+    GIVEN("The chord templates") {
+        THEN("the held pitch classes match the expected chords") {
+            auto recognise = [](std::vector<int> pitches) {
+                ChordRecogniser recogniser;
+                for(auto p : pitches) recogniser.noteOn(p);
+                return ChordRecogniser::symbol(ChordRecogniser::match(recogniser.mask(), recogniser.bass()));
+            };
+            REQUIRE(recognise({60, 64, 67}) == "C");
+            REQUIRE(recognise({53, 56, 60}) == "Fm");
+            REQUIRE(recognise({60, 64, 67, 70}) == "C7");
+            REQUIRE(recognise({57, 60, 64, 67}) == "Am7");
+            REQUIRE(recognise({60, 64, 67, 69}) == "C6");
+            REQUIRE(recognise({62, 67, 69}) == "Dsus4");
+            REQUIRE(recognise({51, 54, 58, 61}) == "Ebm7");
+        }
+    }
+
+    GIVEN("A recogniser with a C major chord held for the hold time") {
+        ChordRecogniser recogniser;
+        recogniser.noteOn(60);
+        recogniser.noteOn(64);
+        recogniser.noteOn(67);
+        REQUIRE(recogniser.update(0, 50) < 0);
+        REQUIRE(recogniser.pending());
+        REQUIRE(ChordRecogniser::symbol(recogniser.update(50, 50)) == "C");
+
+        WHEN("a passing note is added") {
+            recogniser.noteOn(62);
+            THEN("the chord stays") {
+                REQUIRE(recogniser.update(100, 50) < 0);
+                REQUIRE(!recogniser.pending());
+            }
+            recogniser.noteOff(62);
+        }
+
+        WHEN("the chord changes to A minor") {
+            recogniser.noteOff(67);
+            recogniser.noteOn(57);
+            THEN("it is published after the hold time") {
+                REQUIRE(recogniser.update(200, 50) < 0);
+                REQUIRE(recogniser.update(240, 50) < 0);
+                REQUIRE(ChordRecogniser::symbol(recogniser.update(250, 50)) == "Am");
+            }
+        }
+
+        WHEN("all notes are released") {
+            recogniser.clear();
+            THEN("nothing is published") {
+                REQUIRE(recogniser.update(300, 50) < 0);
+            }
+        }
+    }
+}
+
+SCENARIO("the input queue keeps the order of every producer") {
+
+    GIVEN("Four threads that push numbered events at once") {
+        MpscQueue<std::pair<int, int>, 1024> queue;
+        const int c_producers = 4;
+        const int c_events = 200;
+
+        std::vector<std::thread> producers;
+        for(int p=0; p<c_producers; p++) {
+            producers.emplace_back([&queue, p]() {
+                for(int i=0; i<c_events; i++) {
+                    while(!queue.push({p, i})) std::this_thread::yield();
+                }
+            });
+        }
+        for(auto& producer : producers) producer.join();
+
+        THEN("the consumer pops every event once, in the order of its producer") {
+            std::vector<int> next(c_producers, 0);
+            std::pair<int, int> event;
+            int popped = 0;
+            while(queue.pop(event)) {
+                REQUIRE(event.second == next[event.first]);
+                next[event.first]++;
+                popped++;
+            }
+            REQUIRE(popped == c_producers * c_events);
+        }
+    }
+
+    GIVEN("A full queue") {
+        MpscQueue<int, 4> queue;
+        for(int i=0; i<4; i++) REQUIRE(queue.push(i));
+
+        THEN("a push fails instead of waiting, and succeeds again after a pop") {
+            int value = -1;
+            REQUIRE(!queue.push(4));
+            REQUIRE(queue.pop(value));
+            REQUIRE(value == 0);
+            REQUIRE(queue.push(4));
+        }
+    }
+}
+
+// A subscriber that can notify, and unsubscribe, from within its notification
+struct BusSubscriber {
+    enum class types { changed, enum_count };
+    NotificationBus<BusSubscriber, types>* bus = nullptr;
+    int notified = 0;
+    bool unsubscribe_when_notified = false;
+    bool notify_when_notified = false;
+
+    void notify(BusSubscriber* notifying_instance, types type) {
+        notified++;
+        if(unsubscribe_when_notified) bus->unsubscribe_all(this);
+        if(notify_when_notified) {
+            notify_when_notified = false;
+            bus->notify(this, type);
+        }
+    }
+};
+
+SCENARIO("the notification bus notifies outside its lock") {
+
+    GIVEN("Two subscribers") {
+        NotificationBus<BusSubscriber, BusSubscriber::types> bus;
+        BusSubscriber a, b;
+        a.bus = &bus;
+        b.bus = &bus;
+        bus.subscribe(&a, BusSubscriber::types::changed);
+        bus.subscribe(&b, BusSubscriber::types::changed);
+
+        THEN("a subscriber can notify again and unsubscribe from its notification") {
+            a.notify_when_notified = true;
+            a.unsubscribe_when_notified = true;
+            bus.notify(&a, BusSubscriber::types::changed);
+            REQUIRE(a.notified == 1);
+            REQUIRE(b.notified == 2);
+            REQUIRE(bus.num_subscribers(BusSubscriber::types::changed) == 1);
+        }
+    }
+}
+
+SCENARIO("the random generator is reproducible from its seed") {
+
+    GIVEN("Two generators with the same seed and one with another seed") {
+        Random a(42);
+        Random b(42);
+        Random c(43);
+
+        THEN("the same seed gives the same sequence") {
+            bool all_same = true;
+            bool all_same_as_other = true;
+            for(int i=0; i<100; i++) {
+                const auto value = a.next();
+                all_same = all_same && value == b.next();
+                all_same_as_other = all_same_as_other && value == c.next();
+            }
+            REQUIRE(all_same);
+            REQUIRE(!all_same_as_other);
+        }
+
+        THEN("below stays in range") {
+            bool in_range = true;
+            for(int i=0; i<1000; i++) {
+                const int value = a.below(7);
+                in_range = in_range && value >= 0 && value < 7;
+            }
+            REQUIRE(in_range);
+        }
+    }
+}
+
+SCENARIO("the live set finds beats and bars from the time signature") {
+
+    GIVEN("A live set in 6/8") {
+        LiveSet live_set;
+        live_set.set_time_signature(6, 8);
+
+        THEN("a beat is an eighth note and a bar is three quarter notes") {
+            live_set.set_beats(2.9);
+            REQUIRE(live_set.get_beat_index() == 5);
+            REQUIRE(live_set.get_bar_index() == 0);
+            live_set.set_beats(3.0);
+            REQUIRE(live_set.get_beat_index() == 6);
+            REQUIRE(live_set.get_bar_index() == 1);
+        }
+    }
+}
+
+// The messages sent from an outlet of an object, as atoms
+static std::vector<atoms> output_of(repitch& object, int outlet) {
+    std::vector<atoms> messages;
+    for(const auto& message : *c74::max::object_getoutput(object, outlet)) messages.push_back(atoms(message.begin(), message.end()));
+    return messages;
+}
+
+static void clear_output(repitch& object) {
+    c74::max::object_getoutput(object, 0)->clear();
+    c74::max::object_getoutput(object, 1)->clear();
+}
+
+// The output pitches of the note ons sent by an object, in order
+static std::vector<int> note_ons(repitch& object) {
+    std::vector<int> pitches;
+    for(const auto& message : output_of(object, 0)) {
+        if(message.size() == 3 && static_cast<std::string>(message[0]) == "note" && static_cast<int>(message[2]) > 0) pitches.push_back(message[1]);
+    }
+    return pitches;
+}
+
+static std::vector<int> sorted_pitches(const ChordCache::Entry& chord) {
+    std::vector<int> pitches(chord.pitches.begin(), chord.pitches.end());
+    std::sort(pitches.begin(), pitches.end());
+    return pitches;
+}
+
+SCENARIO("an instance with latency plays the next chord ahead of the change") {
+    ext_main(nullptr);
+
+    GIVEN("An instance that plays the chords, 500 ms early at 120 bpm, so one beat ahead") {
+        test_wrapper<repitch> an_instance;
+        repitch&              my_object = an_instance;
+
+        my_object.play_chord = 1;
+        my_object.latency = 500.0;
+        my_object.tempo({120.0});
+        my_object.set_chord_track({"Fm", 0, 4, "Db", 4, 8});
+        my_object.playing({1});
+        my_object.number({2.5});
+        my_object.drain_input();
+        clear_output(my_object);
+
+        WHEN("the position is less than a beat before the change") {
+            my_object.number({3.25});
+            my_object.drain_input();
+
+            THEN("the next chord is played and banged already") {
+                auto pitches = note_ons(my_object);
+                std::sort(pitches.begin(), pitches.end());
+                REQUIRE(pitches == sorted_pitches(ChordCache::get("Db")));
+                REQUIRE(output_of(my_object, 1).size() == 1);
+            }
+
+            AND_WHEN("the transport reaches the change") {
+                clear_output(my_object);
+                my_object.number({4.0});
+                my_object.drain_input();
+
+                THEN("the chord is not played again") {
+                    REQUIRE(note_ons(my_object).empty());
+                    REQUIRE(output_of(my_object, 1).empty());
+                }
+            }
+        }
+
+        my_object.playing({0});
+        my_object.drain_input();
+    }
+}
+
+SCENARIO("only the springs that reset their arps on beats or bars need them") {
+
+    GIVEN("Springs that do not reset their arps on the transport") {
+        Springs springs;
+        for(int index=0; index<Springs::c_num_springs; index++) springs.setParam(index, Springs::spring_params::arp_reset, 0);
+        bool needs_beats, needs_bars;
+
+        THEN("neither beats nor bars are needed") {
+            springs.arpResets(needs_beats, needs_bars);
+            REQUIRE(!needs_beats);
+            REQUIRE(!needs_bars);
+        }
+
+        WHEN("a spring resets on the bar") {
+            springs.setParam(2, Springs::spring_params::arp_reset, 2);
+            springs.arpResets(needs_beats, needs_bars);
+
+            THEN("only the bars are needed") {
+                REQUIRE(!needs_beats);
+                REQUIRE(needs_bars);
+            }
+        }
+
+        WHEN("a spring resets on the beat") {
+            springs.setParam(2, Springs::spring_params::arp_reset, 3);
+            springs.arpResets(needs_beats, needs_bars);
+
+            THEN("the beats and the bars are needed") {
+                REQUIRE(needs_beats);
+                REQUIRE(needs_bars);
+            }
+        }
+
+        springs.setParam(2, Springs::spring_params::arp_reset, 0);
+    }
+}
+
+SCENARIO("every instance applies its own offset") {
+    ext_main(nullptr);
+
+    GIVEN("Two instances playing the chords, the second half a beat ahead of the first") {
+        test_wrapper<repitch> first_instance;
+        test_wrapper<repitch> second_instance;
+        repitch& first  = first_instance;
+        repitch& second = second_instance;
+
+        for(repitch* instance : {&first, &second}) instance->play_chord = 1;
+        second.offset = -0.5;
+        first.tempo({120.0});
+        first.set_chord_track({"Fm", 0, 4, "Db", 4, 8});
+        first.playing({1});
+
+        // Both instances get the position, the first is the clock owner
+        auto position = [&](double beats) {
+            for(repitch* instance : {&first, &second}) instance->number({beats});
+            for(repitch* instance : {&first, &second}) instance->drain_input();
+        };
+        position(2.0);
+        clear_output(first);
+        clear_output(second);
+
+        WHEN("the position is less than half a beat before the change") {
+            position(3.75);
+
+            THEN("only the instance with the offset has changed the chord") {
+                REQUIRE(output_of(first, 1).empty());
+                REQUIRE(output_of(second, 1).size() == 1);
+                auto pitches = note_ons(second);
+                std::sort(pitches.begin(), pitches.end());
+                REQUIRE(pitches == sorted_pitches(ChordCache::get("Db")));
+            }
+
+            AND_WHEN("the transport reaches the change") {
+                clear_output(first);
+                clear_output(second);
+                position(4.0);
+
+                THEN("the first instance changes the chord and the second does not again") {
+                    REQUIRE(output_of(first, 1).size() == 1);
+                    REQUIRE(output_of(second, 1).empty());
+                }
+            }
+        }
+
+        first.playing({0});
+        for(repitch* instance : {&first, &second}) instance->drain_input();
+    }
+}
+
+SCENARIO("an edit of the chord track during playback only plays the chords it changed") {
+    ext_main(nullptr);
+
+    GIVEN("An instance one beat early that has played the next chord ahead") {
+        test_wrapper<repitch> an_instance;
+        repitch&              my_object = an_instance;
+
+        my_object.play_chord = 1;
+        my_object.latency = 500.0;
+        my_object.tempo({120.0});
+        my_object.set_chord_track({"C", 0, 2, "Fm", 2, 4, "Db", 4, 8});
+        my_object.playing({1});
+        my_object.number({3.25});
+        my_object.drain_input();
+        clear_output(my_object);
+
+        WHEN("a chord before the playhead is removed, so the indices of the track move") {
+            my_object.remove_chords({0, 2});
+            my_object.number({3.3});
+            my_object.drain_input();
+
+            THEN("the chord that was played ahead is not sent again") {
+                REQUIRE(note_ons(my_object).empty());
+                REQUIRE(output_of(my_object, 1).empty());
+            }
+
+            AND_WHEN("a chord after it is added and the transport moves on") {
+                my_object.insert_chords({"Ab", 8, 12});
+                my_object.number({3.5});
+                my_object.drain_input();
+
+                THEN("nothing is sent either") {
+                    REQUIRE(note_ons(my_object).empty());
+                    REQUIRE(output_of(my_object, 1).empty());
+                }
+            }
+
+            AND_WHEN("the chord that was played ahead is replaced") {
+                my_object.replace_chords({4, 8, "Eb", 4, 8});
+                my_object.number({3.6});
+                my_object.drain_input();
+
+                THEN("the new chord is looked up in the edited track and played") {
+                    auto pitches = note_ons(my_object);
+                    std::sort(pitches.begin(), pitches.end());
+                    REQUIRE(pitches == sorted_pitches(ChordCache::get("Eb")));
+                    REQUIRE(output_of(my_object, 1).size() == 1);
+                }
+            }
+        }
+
+        my_object.playing({0});
+        my_object.drain_input();
+    }
+}
+
+// The output pitches of the note offs sent by an object
+static std::vector<int> note_offs(repitch& object) {
+    std::vector<int> pitches;
+    for(const auto& message : output_of(object, 0)) {
+        if(message.size() == 3 && static_cast<std::string>(message[0]) == "note" && static_cast<int>(message[2]) == 0) pitches.push_back(message[1]);
+    }
+    return pitches;
+}
+
+SCENARIO("the transport is followed from reads of the ITM") {
+    ext_main(nullptr);
+
+    GIVEN("An instance that plays the chords of a chord track") {
+        test_wrapper<repitch> an_instance;
+        repitch&              my_object = an_instance;
+
+        my_object.play_chord = 1;
+        my_object.set_chord_track({"Fm", 0, 4, "Db", 4, 8});
+        clear_output(my_object);
+
+        ItmTransport itm;
+        itm.tempo = 90.0;
+        itm.numerator = 3;
+        itm.denominator = 4;
+        itm.playing = true;
+        itm.beats = 1.0;
+
+        WHEN("the ITM is read playing") {
+            my_object.follow_itm(itm);
+            my_object.drain_input();
+
+            THEN("the live set follows its tempo, time signature and position, and the chord is played") {
+                REQUIRE(repitch::live_set().get_tempo() == 90.0);
+                REQUIRE(repitch::live_set().get_bar_length() == 3.0);
+                REQUIRE(repitch::live_set().get_is_playing());
+                REQUIRE(repitch::live_set().get_beats() == 1.0);
+                // Starting playback and the chord changing at the first tick may both strike it
+                auto pitches = note_ons(my_object);
+                std::sort(pitches.begin(), pitches.end());
+                pitches.erase(std::unique(pitches.begin(), pitches.end()), pitches.end());
+                REQUIRE(pitches == sorted_pitches(ChordCache::get("Fm")));
+            }
+
+            AND_WHEN("the same position is read again") {
+                clear_output(my_object);
+                my_object.follow_itm(itm);
+                my_object.drain_input();
+
+                THEN("nothing is sent") {
+                    REQUIRE(output_of(my_object, 0).empty());
+                    REQUIRE(output_of(my_object, 1).empty());
+                }
+            }
+
+            AND_WHEN("the position has moved into the next chord") {
+                clear_output(my_object);
+                itm.beats = 4.5;
+                my_object.follow_itm(itm);
+                my_object.drain_input();
+
+                THEN("the chord changes") {
+                    REQUIRE(repitch::live_set().get_beats() == 4.5);
+                    REQUIRE(output_of(my_object, 1).size() == 1);
+                    auto pitches = note_ons(my_object);
+                    std::sort(pitches.begin(), pitches.end());
+                    REQUIRE(pitches == sorted_pitches(ChordCache::get("Db")));
+                }
+            }
+
+            AND_WHEN("the ITM is read stopped") {
+                clear_output(my_object);
+                itm.playing = false;
+                my_object.follow_itm(itm);
+                my_object.drain_input();
+
+                THEN("the chord is stopped") {
+                    REQUIRE(!repitch::live_set().get_is_playing());
+                    REQUIRE(!note_offs(my_object).empty());
+                    REQUIRE(note_ons(my_object).empty());
+                }
+            }
+        }
+
+        // Leave the live set as the other tests expect it
+        itm.tempo = 120.0;
+        itm.numerator = 4;
+        itm.playing = false;
+        my_object.follow_itm(itm);
+        my_object.drain_input();
+    }
+}
+
+SCENARIO("an instance that steals its own voice stops that note once") {
+    ext_main(nullptr);
+
+    GIVEN("An instance that plays an instrument with two voices, stealing the oldest") {
+        test_wrapper<repitch> an_instance;
+        repitch&              my_object = an_instance;
+
+        my_object.note_mode = repitch::note_modes::pass;
+        my_object.voice_inst = 2;
+        my_object.voice_steal = VoiceBudget::steal_modes::oldest;
+        my_object.set_voice_budget({2, 2});
+        clear_output(my_object);
+
+        WHEN("three notes are played") {
+            for(int pitch : {60, 64, 67}) my_object.note({pitch, 100});
+            my_object.drain_input();
+
+            THEN("the third note takes the voice of the first, which is stopped") {
+                REQUIRE(note_ons(my_object) == std::vector<int>({60, 64, 67}));
+                REQUIRE(note_offs(my_object) == std::vector<int>({60}));
+            }
+
+            AND_WHEN("the first note is released") {
+                clear_output(my_object);
+                my_object.note({60, 0});
+                my_object.drain_input();
+
+                THEN("it is not stopped again") {
+                    REQUIRE(note_offs(my_object).empty());
+                }
+            }
+        }
+
+        for(int pitch : {60, 64, 67}) my_object.note({pitch, 0});
+        my_object.drain_input();
+        my_object.set_voice_budget({2, 0});
+    }
+}
+
+SCENARIO("the diff voicing only changes the tones that differ between chords") {
+    ext_main(nullptr);
+
+    GIVEN("An instance that plays C and then Em with the diff voicing") {
+        test_wrapper<repitch> an_instance;
+        repitch&              my_object = an_instance;
+
+        my_object.play_chord = 1;
+        my_object.voicing = repitch::voicing_modes::diff;
+        my_object.set_chord_track({"C", 0, 4, "Em", 4, 8});
+        my_object.playing({1});
+        my_object.number({2.0});
+        my_object.drain_input();
+        clear_output(my_object);
+
+        const auto from = sorted_pitches(ChordCache::get("C"));
+        const auto to   = sorted_pitches(ChordCache::get("Em"));
+        std::vector<int> common, stopped, started;
+        std::set_intersection(from.begin(), from.end(), to.begin(), to.end(), std::back_inserter(common));
+        std::set_difference(from.begin(), from.end(), to.begin(), to.end(), std::back_inserter(stopped));
+        std::set_difference(to.begin(), to.end(), from.begin(), from.end(), std::back_inserter(started));
+        REQUIRE(!common.empty());
+
+        WHEN("the chord changes") {
+            my_object.number({4.5});
+            my_object.drain_input();
+
+            THEN("the common tones are held, and only the other tones are stopped and started") {
+                auto offs = note_offs(my_object);
+                auto ons  = note_ons(my_object);
+                std::sort(offs.begin(), offs.end());
+                std::sort(ons.begin(), ons.end());
+                REQUIRE(offs == stopped);
+                REQUIRE(ons == started);
+                REQUIRE(output_of(my_object, 1).size() == 1);
+            }
+        }
+
+        my_object.playing({0});
+        my_object.drain_input();
+    }
+}
+
+SCENARIO("random pitches and spring parameters are answered in order with the input") {
+    ext_main(nullptr);
+
+    GIVEN("An instance with the chord C") {
+        test_wrapper<repitch> an_instance;
+        repitch&              my_object = an_instance;
+
+        my_object.set_chord({"C"});
+        my_object.drain_input();
+        clear_output(my_object);
+        const auto& chord = ChordCache::get("C");
+
+        WHEN("random pitches are requested") {
+            my_object.get_rand();
+            my_object.noteAt({"rand"});
+
+            THEN("they are sent where the input is drained, from the pitches of the chord") {
+                REQUIRE(output_of(my_object, 0).empty());
+                my_object.drain_input();
+
+                const auto messages = output_of(my_object, 0);
+                REQUIRE(messages.size() == 2);
+                for(const auto& message : messages) {
+                    REQUIRE(message.size() == 1);
+                    REQUIRE(chord.quant_table.contains(static_cast<int>(message[0])));
+                }
+            }
+        }
+
+        WHEN("a spring parameter is set and then requested") {
+            clear_output(my_object);
+            my_object.set_springs_param({0, "velocity", 90});
+            my_object.get_springs_param({"0-velocity"});
+
+            THEN("the value that was set is sent") {
+                REQUIRE(output_of(my_object, 0).empty());
+                my_object.drain_input();
+
+                const auto messages = output_of(my_object, 0);
+                REQUIRE(messages.size() == 1);
+                REQUIRE(static_cast<int>(messages[0][0]) == 90);
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/// @file
+///	@ingroup 	robotic-audio 
+///	@copyright	Copyright 2025 Hjalte Bested Hjorth. All rights reserved.
+///	@license	Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min.h"
+#include "rbau.harmonic_context.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace c74::min;
+
+
+// Quantises a pitch signal to the chord of the harmonic context, one vector at a time. 
+// The chord is read once per vector, and compiled into a table when it changes.
+class Quantiser {
+public:
+    Quantiser() {
+        const uint64_t word = HarmonicContext::read();
+        m_serial = HarmonicContext::serial(word);
+        set_mask(HarmonicContext::mask(word));
+    }
+
+    // Quantise a vector of pitches. The trigger is 1 on the first sample of a vector where the chord has changed.
+    void process(const sample* in, sample* out, sample* trigger, long frames) {
+        const uint64_t word = HarmonicContext::read();
+        const bool changed = HarmonicContext::serial(word) != m_serial;
+        if(changed) {
+            m_serial = HarmonicContext::serial(word);
+            set_mask(HarmonicContext::mask(word));
+        }
+
+        // Work in blocks, so the index buffer lives on the stack. The loops are simple enough to be vectorised.
+        for(long start=0; start<frames; start+=c_block_size) {
+            const long n = std::min<long>(c_block_size, frames - start);
+            int index[c_block_size];
+
+            // Round to the nearest midi pitch, and clamp into the table. NaN fails every comparison, so it is mapped to 0
+            // before the cast, which is undefined for NaN.
+            for(long i=0; i<n; i++) {
+                const sample pitch = std::floor(in[start + i] + 0.5);
+                const sample clamped = pitch >= 0.0 ? std::min<sample>(pitch, 127.0) : 0.0;
+                index[i] = static_cast<int>(clamped);
+            }
+
+            // Look up the nearest chord pitch
+            for(long i=0; i<n; i++) out[start + i] = m_nearest[index[i]];
+        }
+
+        std::fill(trigger, trigger + frames, 0.0);
+        if(changed && frames > 0) trigger[0] = 1.0;
+    }
+
+    int mask() const { return m_table.mask(); }
+
+private:
+    static constexpr long c_block_size = 64;
+
+    void set_mask(int mask) {
+        m_table.from_mask(mask);
+        for(int pitch=0; pitch<128; pitch++) m_nearest[pitch] = static_cast<sample>(m_table.nearest(pitch));
+    }
+
+    QuantTable m_table;
+    sample     m_nearest[128];
+    uint64_t   m_serial = 0;
+};
+
+
+class repitch_tilde : public object<repitch_tilde>, public vector_operator<> {
+public:
+    MIN_DESCRIPTION	{"Quantise a pitch signal to the current chord of rbau.repitch."};
+    MIN_TAGS		{"tromleorkestret"};
+    MIN_AUTHOR		{"robotic-4udio"};
+    MIN_RELATED		{"rbau.repitch"};
+
+    inlet<>  input	{ this, "(signal) Pitch, as midi pitch" };
+    outlet<> out1	{ this, "(signal) Pitch quantised to the current chord", "signal" };
+    outlet<> out2	{ this, "(signal) 1 on the first sample of a vector where the chord has changed", "signal" };
+
+    // Quantise one vector
+    void operator()(audio_bundle input, audio_bundle output) {
+        m_quantiser.process(input.samples(0), output.samples(0), output.samples(1), input.frame_count());
+    }
+
+private:
+    Quantiser m_quantiser;
+};
+
+
+MIN_EXTERNAL(repitch_tilde);
@@ -0,0 +1,123 @@
+/// @file
+///	@ingroup 	minexamples
+///	@copyright	Copyright 2018 The Min-DevKit Authors. All rights reserved.
+///	@license	Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min_unittest.h"       // required unit test header
+#include "rbau.repitch_tilde.cpp"    // need the source of our object so that we can access it
+#include <algorithm>
+#include <limits>
+
+// Unit tests are written using the Catch framework as described at
+// https://github.com/philsquared/Catch/blob/master/docs/tutorial.md
+
+SCENARIO("a pitch signal is quantised to the chord of the harmonic context") {
+
+    GIVEN("A quantiser and the chord C E G published") {
+        HarmonicContext::publish((1 << 0) | (1 << 4) | (1 << 7));
+        Quantiser quantiser;
+
+        const long frames = 100;
+        std::vector<sample> in(frames);
+        std::vector<sample> out(frames);
+        std::vector<sample> trigger(frames);
+        for(long i=0; i<frames; i++) in[i] = 55.0 + i * 0.2; // A rising pitch from 55 to 74.8
+
+        WHEN("a buffer is rendered") {
+            quantiser.process(in.data(), out.data(), trigger.data(), frames);
+
+            THEN("every sample is the nearest chord pitch of the rounded input") {
+                QuantTable table;
+                table.from_mask(quantiser.mask());
+                bool all_nearest = true;
+                for(long i=0; i<frames; i++) all_nearest = all_nearest && out[i] == table.nearest(static_cast<int>(std::floor(in[i] + 0.5)));
+                REQUIRE(all_nearest);
+                REQUIRE(out[0] == 55.0);     // G
+                REQUIRE(out[frames-1] == 76.0); // 75 is nearer to E than to G
+            }
+            THEN("there is no trigger, as the chord has not changed") {
+                REQUIRE(std::count(trigger.begin(), trigger.end(), 1.0) == 0);
+            }
+        }
+
+        WHEN("the chord changes to D F A before the next buffer") {
+            HarmonicContext::publish((1 << 2) | (1 << 5) | (1 << 9));
+            quantiser.process(in.data(), out.data(), trigger.data(), frames);
+
+            THEN("the buffer is quantised to the new chord, and the first sample triggers") {
+                REQUIRE(quantiser.mask() == ((1 << 2) | (1 << 5) | (1 << 9)));
+                REQUIRE(out[0] == 55.0 - 2.0); // F
+                REQUIRE(trigger[0] == 1.0);
+                REQUIRE(std::count(trigger.begin(), trigger.end(), 1.0) == 1);
+            }
+
+            AND_WHEN("the next buffer is rendered") {
+                quantiser.process(in.data(), out.data(), trigger.data(), frames);
+                THEN("it does not trigger again") {
+                    REQUIRE(trigger[0] == 0.0);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("a pitch signal that is not finite stays in the table") {
+
+    GIVEN("A quantiser and the chord C E G published") {
+        HarmonicContext::publish((1 << 0) | (1 << 4) | (1 << 7));
+        Quantiser quantiser;
+        QuantTable table;
+        table.from_mask(quantiser.mask());
+
+        std::vector<sample> in = {std::numeric_limits<sample>::quiet_NaN(), std::numeric_limits<sample>::infinity(),
+                                  -std::numeric_limits<sample>::infinity(), -1000.0, 1000.0};
+        std::vector<sample> out(in.size());
+        std::vector<sample> trigger(in.size());
+
+        WHEN("a buffer is rendered") {
+            quantiser.process(in.data(), out.data(), trigger.data(), static_cast<long>(in.size()));
+
+            THEN("NaN and the negative values give the lowest pitch, and the positive ones the highest") {
+                REQUIRE(out[0] == table.nearest(0));
+                REQUIRE(out[1] == table.nearest(127));
+                REQUIRE(out[2] == table.nearest(0));
+                REQUIRE(out[3] == table.nearest(0));
+                REQUIRE(out[4] == table.nearest(127));
+            }
+        }
+    }
+}
+
+SCENARIO("the object quantises its signal inlet") {
+    ext_main(nullptr);
+
+    GIVEN("An instance and the chord C E G published") {
+        test_wrapper<repitch_tilde> an_instance;
+        repitch_tilde&              my_object = an_instance;
+
+        const long frames = 64;
+        std::vector<sample> in(frames);
+        std::vector<sample> out(frames);
+        std::vector<sample> trigger(frames);
+        for(long i=0; i<frames; i++) in[i] = 60.0 + (i % 12);
+        sample* inputs[]  = {in.data()};
+        sample* outputs[] = {out.data(), trigger.data()};
+        audio_bundle input_bundle  {inputs, 1, frames};
+        audio_bundle output_bundle {outputs, 2, frames};
+
+        WHEN("the chord changes and a vector is rendered") {
+            HarmonicContext::publish((1 << 0) | (1 << 4) | (1 << 7));
+            my_object(input_bundle, output_bundle);
+
+            THEN("the first outlet has the quantised pitches and the second triggers once") {
+                QuantTable table;
+                table.from_mask((1 << 0) | (1 << 4) | (1 << 7));
+                bool all_nearest = true;
+                for(long i=0; i<frames; i++) all_nearest = all_nearest && out[i] == table.nearest(static_cast<int>(in[i]));
+                REQUIRE(all_nearest);
+                REQUIRE(trigger[0] == 1.0);
+                REQUIRE(std::count(trigger.begin(), trigger.end(), 1.0) == 1);
+            }
+        }
+    }
+}
@@ -6,6 +6,37 @@
 #include "c74_min.h"
 #include <set>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #ifdef _MSC_VER
+        #pragma comment(lib, "ws2_32.lib")
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+#endif
+#include <fstream>
+#include <limits>
+#include "rbau.itm_transport.h"
+#include "rbau.notification_bus.h"
 
 using namespace c74::min;
 
@@ -74,7 +105,7 @@ public:
         };;
 
         Clip() : m_id(-1), m_name(""), m_muted(false), m_start_time(-1), m_end_time(-1), m_start_marker(-1), m_end_marker(-1), m_looping(false), m_loop_start(-1), m_loop_end(-1) {}
-        Clip(int a_id, std::string a_name, bool a_muted, double a_start_time, double a_end_time, double a_start_marker, double a_end_marker, bool a_looping, double a_loop_start, double a_loop_end) : m_id(a_id), m_name(a_name), m_muted(a_muted), m_start_time(a_start_time), m_end_time(a_end_time), m_looping(a_looping), m_loop_start(a_loop_start), m_loop_end(a_loop_end) {}
+        Clip(int a_id, std::string a_name, bool a_muted, double a_start_time, double a_end_time, double a_start_marker, double a_end_marker, bool a_looping, double a_loop_start, double a_loop_end) : m_id(a_id), m_name(a_name), m_muted(a_muted), m_start_time(a_start_time), m_end_time(a_end_time), m_start_marker(a_start_marker), m_end_marker(a_end_marker), m_looping(a_looping), m_loop_start(a_loop_start), m_loop_end(a_loop_end) {}
 
         // Init
         void init() {
@@ -161,6 +192,7 @@ public:
         }
 
         // Member variables
+        std::string       m_hash;  // Content hash of the clip, the key in the timeline cache
         int               m_id;
         std::string       m_name;
         bool              m_muted;
@@ -177,11 +209,16 @@ public:
 
     Track() = default;
 
+    // Clear the clips. The cached clips that were not added since the last clear are dropped, the others are kept,
+    // as NoteTracker.js clears the clips before it adds them again from the cache.
     void clear() {
         m_clips.clear();
+        m_previous_cache = std::move(m_cache);
+        m_cache.clear();
     }
 
     void collect_track_notes() {
+        m_version++;
         m_notes.clear();
         // Add all the notes from all the clips to the notes vector
         for(auto& clip : m_clips) {
@@ -191,20 +228,40 @@ public:
         std::sort(m_notes.begin(), m_notes.end(), [](const Clip::Note& a, const Clip::Note& b) { return a.start_time < b.start_time; });
     }
 
-    void from_atoms(const atoms& args){
+    // Add a clip from the atoms of the add_clip message. 
+    // If a hash is given, the clip is also stored in the timeline cache under that hash.
+    // When adding many clips, pass collect=false and call collect_track_notes() once at the end.
+    void from_atoms(const atoms& args, const std::string& hash = "", bool collect = true){
         //  Make a new clip
         Clip clip(args[0], args[1], args[2], args[3], args[4], args[5], args[6], args[7], args[8], args[9]);
+        clip.m_hash = hash;
         
         // Add notes to the clip
-        for(int i=10; i<args.size(); i+=4) {
+        for(int i=10; i+3<args.size(); i+=4) {
             clip.add_note(args[i], args[i+1], args[i+2], args[i+3], false);
         }
 
         // Add the clip to the track
         m_clips.push_back(clip);
+        if(!hash.empty()) m_cache[hash] = clip;
 
         // Collect the notes from the clips - in absolte time with looping
-        collect_track_notes();
+        if(collect) collect_track_notes();
+    }
+
+    // Add a clip from the timeline cache. Returns false if the hash is not in the cache.
+    bool from_cache(const std::string& hash, bool collect = true) {
+        auto it = m_cache.find(hash);
+        if(it == m_cache.end()) {
+            auto previous = m_previous_cache.find(hash);
+            if(previous == m_previous_cache.end()) return false;
+            it = m_cache.insert(*previous).first;
+        }
+
+        m_clips.push_back(it->second);
+
+        if(collect) collect_track_notes();
+        return true;
     }
 
     // Get Clip at time
@@ -241,25 +298,330 @@ public:
     }
 
     std::vector<Clip> m_clips;
+    std::map<std::string, Clip> m_cache; // Clips by content hash, filled by hashed clips and the timeline file
+    std::map<std::string, Clip> m_previous_cache; // The cache before the last clear
     const Clip NoClip = Clip();
     std::vector<Clip::Note> m_notes;
     std::set<Clip::Note*> m_playing_note_ptrs;
+    long m_version = 0; // Incremented every time the notes are collected
 
 };
 
 long Track::Clip::Note::s_counter = 0;
 
+
+// The clips in the session view of the track, and the launches of them.
+// Arrangement clips are compiled into absolute track notes once. Session clips cannot be, as we only know when they play 
+// once they are launched, and looping clips play forever. Instead the notes are generated lazily for a window of time.
+// The launch is known ahead of time through launch quantisation, so the first hits can be played early like arrangement notes.
+class SessionClips {
+public:
+    // A clip playing from start to stop, in absolute beats
+    struct Run {
+        long   id;
+        int    slot;
+        double start;
+        double stop;
+    };
+
+    // A generated note with an absolute start time, and a key that is unique for this occurrence of the note
+    struct SessionNote {
+        Track::Clip::Note note;
+        long long         key;
+        bool              playing;
+    };
+
+    void clear() {
+        m_slots.clear();
+        m_runs.clear();
+        m_version++;
+    }
+
+    // Add or replace the clip in a slot
+    void set_clip(int slot, const Track::Clip& clip) {
+        m_slots[slot] = clip;
+        m_version++;
+    }
+
+    // Launch the clip in a slot at the given beat. A playing clip stops when the new clip starts.
+    void launch(int slot, double beat) {
+        stop(beat);
+        m_runs.push_back(Run{++m_run_counter, slot, beat, std::numeric_limits<double>::infinity()});
+        m_version++;
+    }
+
+    // Stop the playing clip at the given beat, and forget the runs that stopped long before
+    void stop(double beat) {
+        for(auto& run : m_runs) {
+            if(run.stop > beat) run.stop = std::max(beat, run.start);
+        }
+        prune(beat - 1.0);
+        m_version++;
+    }
+
+    // Stop all clips now, e.g. when the transport stops
+    void stop_all() {
+        m_runs.clear();
+        m_version++;
+    }
+
+    // Is a session clip playing at the given beat? Then the arrangement of the track is not playing.
+    bool covers(double beat) const {
+        for(auto& run : m_runs) {
+            if(run.start <= beat && beat < run.stop) return true;
+        }
+        return false;
+    }
+
+    // Generate the notes starting in [from, to) for all runs
+    void collect(double from, double to, std::vector<SessionNote>& out) const {
+        for(auto& run : m_runs) {
+            auto it = m_slots.find(run.slot);
+            if(it == m_slots.end()) continue;
+            collect_run(run, it->second, from, to, out);
+        }
+    }
+
+    // Forget runs that stopped before the given beat
+    void prune(double beat) {
+        m_runs.erase(std::remove_if(m_runs.begin(), m_runs.end(), [beat](const Run& run) { return run.stop < beat; }), m_runs.end());
+    }
+
+    long version() const { return m_version; }
+
+private:
+    // A session clip plays from the start marker. Without looping it ends at the end marker.
+    // With looping it plays to the loop end and then repeats the loop region forever.
+    static void collect_run(const Run& run, const Track::Clip& clip, double from, double to, std::vector<SessionNote>& out) {
+        if(clip.m_muted) return;
+
+        // The window in time relative to the start of the run
+        double window_from = std::max(from, run.start) - run.start;
+        double window_to   = std::min(to, run.stop) - run.start;
+        if(window_to <= window_from) return;
+
+        const double first_pass_end = clip.m_looping ? clip.m_loop_end : clip.m_end_marker;
+        const double first_pass_length = first_pass_end - clip.m_start_marker;
+        const double loop_length = clip.m_loop_end - clip.m_loop_start;
+
+        for(size_t n=0; n<clip.m_notes.size(); n++) {
+            const auto& clip_note = clip.m_notes[n];
+            if(clip_note.mute) continue;
+
+            // The first pass from the start marker
+            if(clip_note.start_time >= clip.m_start_marker && clip_note.start_time < first_pass_end) {
+                double t = clip_note.start_time - clip.m_start_marker;
+                if(t >= window_from && t < window_to) add_note(run, clip_note, t, n, 0, out);
+            }
+
+            // The loop passes
+            if(!clip.m_looping || loop_length <= 0.0) continue;
+            if(clip_note.start_time < clip.m_loop_start || clip_note.start_time >= clip.m_loop_end) continue;
+
+            double t0 = first_pass_length + (clip_note.start_time - clip.m_loop_start);
+            long long k = static_cast<long long>(std::ceil((window_from - t0) / loop_length));
+            if(k < 0) k = 0;
+            for(double t = t0 + k * loop_length; t < window_to; t += loop_length, k++) {
+                if(t >= window_from) add_note(run, clip_note, t, n, k + 1, out);
+            }
+        }
+    }
+
+    static void add_note(const Run& run, const Track::Clip::Note& clip_note, double t, size_t index, long long pass, std::vector<SessionNote>& out) {
+        SessionNote session_note;
+        session_note.note = clip_note;
+        session_note.note.start_time = run.start + t;
+        session_note.key = (static_cast<long long>(run.id) << 44) ^ (static_cast<long long>(index) << 24) ^ pass;
+        session_note.playing = false;
+        out.push_back(session_note);
+    }
+
+    std::map<int, Track::Clip> m_slots;
+    std::vector<Run>           m_runs;
+    long                       m_run_counter = 0;
+    long                       m_version = 0;
+};
+
+
+// A read only memory mapped file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(m_file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!m_mapping) return;
+        m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if(m_data) m_size = static_cast<size_t>(size.QuadPart);
+#else
+        m_file = ::open(path.c_str(), O_RDONLY);
+        if(m_file < 0) return;
+        struct stat st;
+        if(fstat(m_file, &st) != 0 || st.st_size == 0) return;
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+        if(data == MAP_FAILED) return;
+        m_data = static_cast<const char*>(data);
+        m_size = static_cast<size_t>(st.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if(m_data) UnmapViewOfFile(m_data);
+        if(m_mapping) CloseHandle(m_mapping);
+        if(m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+        if(m_data) munmap(const_cast<char*>(m_data), m_size);
+        if(m_file >= 0) ::close(m_file);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool        is_open() const { return m_data != nullptr; }
+    const char* data()    const { return m_data; }
+    size_t      size()    const { return m_size; }
+
+private:
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int    m_file = -1;
+#endif
+    const char* m_data = nullptr;
+    size_t      m_size = 0;
+};
+
+
+// The timeline cache file. A compact file of fixed size records that can be mapped directly:
+// A header, followed by one ClipRecord per clip, followed by the NoteRecords of all clips.
+// The clips are keyed by the content hash computed by NoteTracker.js, so unchanged clips do not need to be re-sent on reload.
+class TimelineFile {
+public:
+    static constexpr uint32_t c_version = 1;
+
+    struct Header {
+        char     magic[4];
+        uint32_t version;
+        uint32_t num_clips;
+        uint32_t num_notes;
+    };
+
+    struct ClipRecord {
+        char     hash[32];
+        char     name[64];
+        int32_t  id;
+        int32_t  muted;
+        int32_t  looping;
+        int32_t  padding;
+        uint32_t first_note;
+        uint32_t num_notes;
+        double   start_time;
+        double   end_time;
+        double   start_marker;
+        double   end_marker;
+        double   loop_start;
+        double   loop_end;
+    };
+
+    struct NoteRecord {
+        double  start_time;
+        double  duration;
+        int32_t pitch;
+        int32_t velocity;
+    };
+
+    // Write the clips that have a hash. Returns the number of clips written, or -1 on error.
+    static int write(const std::string& path, const std::vector<Track::Clip>& clips) {
+        std::vector<ClipRecord> clip_records;
+        std::vector<NoteRecord> note_records;
+
+        for(auto& clip : clips) {
+            if(clip.m_hash.empty() || clip.m_hash.size() >= sizeof(ClipRecord::hash)) continue;
+
+            ClipRecord record = {};
+            std::strncpy(record.hash, clip.m_hash.c_str(), sizeof(record.hash) - 1);
+            std::strncpy(record.name, clip.m_name.c_str(), sizeof(record.name) - 1);
+            record.id           = clip.m_id;
+            record.muted        = clip.m_muted;
+            record.looping      = clip.m_looping;
+            record.first_note   = static_cast<uint32_t>(note_records.size());
+            record.num_notes    = static_cast<uint32_t>(clip.m_notes.size());
+            record.start_time   = clip.m_start_time;
+            record.end_time     = clip.m_end_time;
+            record.start_marker = clip.m_start_marker;
+            record.end_marker   = clip.m_end_marker;
+            record.loop_start   = clip.m_loop_start;
+            record.loop_end     = clip.m_loop_end;
+            clip_records.push_back(record);
+
+            for(auto& note : clip.m_notes) {
+                note_records.push_back(NoteRecord{note.start_time, note.duration, note.pitch, note.velocity});
+            }
+        }
+
+        Header header = {{'T','L','C','F'}, c_version, static_cast<uint32_t>(clip_records.size()), static_cast<uint32_t>(note_records.size())};
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if(!file) return -1;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(clip_records.data()), clip_records.size() * sizeof(ClipRecord));
+        file.write(reinterpret_cast<const char*>(note_records.data()), note_records.size() * sizeof(NoteRecord));
+        return file ? static_cast<int>(clip_records.size()) : -1;
+    }
+
+    // Map the file and add its clips to the cache. Returns the number of clips read, or -1 on error.
+    // The clips are copied out of the mapping, as the cache holds Track::Clips, which add_cached_clip copies to the track.
+    static int read(const std::string& path, std::map<std::string, Track::Clip>& cache) {
+        MappedFile file(path);
+        if(!file.is_open() || file.size() < sizeof(Header)) return -1;
+
+        const Header* header = reinterpret_cast<const Header*>(file.data());
+        if(std::strncmp(header->magic, "TLCF", 4) != 0 || header->version != c_version) return -1;
+
+        const size_t expected_size = sizeof(Header) + header->num_clips * sizeof(ClipRecord) + header->num_notes * sizeof(NoteRecord);
+        if(file.size() < expected_size) return -1;
+
+        const ClipRecord* clip_records = reinterpret_cast<const ClipRecord*>(file.data() + sizeof(Header));
+        const NoteRecord* note_records = reinterpret_cast<const NoteRecord*>(file.data() + sizeof(Header) + header->num_clips * sizeof(ClipRecord));
+
+        for(uint32_t i=0; i<header->num_clips; i++) {
+            const ClipRecord& record = clip_records[i];
+            if(static_cast<uint64_t>(record.first_note) + record.num_notes > header->num_notes) return -1;
+
+            Track::Clip clip(record.id, std::string(record.name, strnlen(record.name, sizeof(record.name))), record.muted != 0, record.start_time, record.end_time, record.start_marker, record.end_marker, record.looping != 0, record.loop_start, record.loop_end);
+            clip.m_hash = std::string(record.hash, strnlen(record.hash, sizeof(record.hash)));
+            clip.m_notes.reserve(record.num_notes);
+            for(uint32_t n=record.first_note; n<record.first_note + record.num_notes; n++) {
+                const NoteRecord& note = note_records[n];
+                clip.add_note(note.pitch, note.start_time, note.duration, note.velocity, false);
+            }
+            cache[clip.m_hash] = clip;
+        }
+        return static_cast<int>(header->num_clips);
+    }
+};
+
 class DrumTrigger {
 public:
     DrumTrigger() = default;
-    DrumTrigger(int a_pitch_in, int a_pitch_out, int a_velocity_min=0, int a_velocity_max=127, std::string a_name="") : pitch_in(a_pitch_in), pitch_out(a_pitch_out), velocity_min(a_velocity_min), velocity_max(a_velocity_max), name(a_name) {}
+    DrumTrigger(int a_pitch_in, int a_pitch_out, int a_velocity_min=0, int a_velocity_max=127, std::string a_name="", double a_curve=1.0, double a_pulse_width=0.0) : pitch_in(a_pitch_in), pitch_out(a_pitch_out), velocity_min(a_velocity_min), velocity_max(a_velocity_max), name(a_name), curve(a_curve), pulse_width(a_pulse_width) {}
 
 
-    // Get scaled velocity
+    // Get scaled velocity. A curve of 1.0 is linear, above 1.0 soft hits get softer, below 1.0 soft hits get harder.
     int get_velocity(int velocity) const {
-        return velocity_min + (velocity_max - velocity_min) * velocity / 127;
+        if(curve == 1.0 || curve <= 0.0) return velocity_min + (velocity_max - velocity_min) * velocity / 127;
+        return velocity_min + static_cast<int>((velocity_max - velocity_min) * std::pow(velocity / 127.0, curve));
     }
 
+    // Is this a valid trigger
+    bool isValid() const { return pitch_in >= 0 && pitch_in < 128 && pitch_out >= 0; }
+
     // Equality operator
     bool operator==(const DrumTrigger& other) const {
         return pitch_in == other.pitch_in;
@@ -272,7 +634,7 @@ public:
 
     // Stream operator to print the drum trigger
     friend std::ostream& operator<<(std::ostream& os, const DrumTrigger& drum_trigger) {
-        os << "DrumTrigger:(" << drum_trigger.name << "," << drum_trigger.pitch_in << "," << drum_trigger.pitch_out << "," << drum_trigger.velocity_min << "," << drum_trigger.velocity_max << ")";
+        os << "DrumTrigger:(" << drum_trigger.name << "," << drum_trigger.pitch_in << "," << drum_trigger.pitch_out << "," << drum_trigger.velocity_min << "," << drum_trigger.velocity_max << "," << drum_trigger.curve << "," << drum_trigger.pulse_width << ")";
         return os;
     }
 
@@ -282,10 +644,373 @@ public:
     int velocity_min = 0;
     int velocity_max = 127;
     std::string name = "";
+    double curve = 1.0;       // Velocity curve exponent
+    double pulse_width = 0.0; // Solenoid pulse width in ms, 0 means use the default of the receiver
 
 };  
 
 
+// A complete mapping table for one instrument setup: pitch map, velocity curves, pulse widths and time offsets.
+// A TriggerMap is never changed once it is published to the tick path. Edits are made on a copy which is then swapped in.
+class TriggerMap {
+public:
+    TriggerMap() = default;
+
+    // Number of velocity buckets for the velocity dependent time offsets. Bucket b covers velocity b*16 to b*16+15.
+    static constexpr int c_velocity_buckets = 8;
+
+    // The entries of a trigger map dict by key
+    using Entries = std::map<std::string, atoms>;
+
+    // Read the entries of a mapping from a Max dictionary, on the main thread.
+    // The keys follow the same "<index>-<param>" layout as the springs dict, where the index is the incoming pitch:
+    // "36-pitch_out", "36-velocity_min", "36-velocity_max", "36-curve", "36-pulse_width", "36-offset", "36-velocity_offsets", "36-name"
+    static Entries read_entries(c74::max::t_dictionary* d) {
+        Entries entries;
+        if(!d) return entries;
+
+        for(int pitch=0; pitch<128; pitch++) {
+            const std::string index_str = std::to_string(pitch) + "-";
+            for(const char* param : c_params) {
+                const std::string key = index_str + param;
+                c74::max::t_atom value;
+                if(c74::max::dictionary_getatom(d, symbol(key), &value) == 0) entries[key] = {atom(value)};
+            }
+
+            long num_offsets = 0;
+            c74::max::t_atom* offsets = nullptr;
+            if(c74::max::dictionary_getatoms(d, symbol(index_str + "velocity_offsets"), &num_offsets, &offsets) == 0 && offsets) {
+                atoms& entry = entries[index_str + "velocity_offsets"];
+                for(long b=0; b<num_offsets && b<c_velocity_buckets; b++) entry.push_back(atom(offsets[b]));
+            }
+        }
+        return entries;
+    }
+
+    // Compile a mapping from the entries of a dictionary. Uses no Max API, so it can run on any thread.
+    // A pitch is mapped when it has a "<pitch>-pitch_out" entry. "<pitch>-offset" and "<pitch>-velocity_offsets" may be given without a mapping.
+    static std::shared_ptr<TriggerMap> from_entries(const Entries& entries) {
+        auto map = std::make_shared<TriggerMap>();
+
+        for(int pitch=0; pitch<128; pitch++) {
+            const std::string index_str = std::to_string(pitch) + "-";
+            atom value;
+
+            if(get_entry(entries, index_str + "offset", value)) map->m_time_offsets[pitch] = value;
+
+            auto offsets = entries.find(index_str + "velocity_offsets");
+            if(offsets != entries.end()) {
+                for(size_t b=0; b<offsets->second.size() && b<c_velocity_buckets; b++) {
+                    map->m_velocity_offsets[pitch][b] = offsets->second[b];
+                }
+            }
+
+            if(!get_entry(entries, index_str + "pitch_out", value)) continue;
+            DrumTrigger trigger;
+            trigger.pitch_in = pitch;
+            trigger.pitch_out = value;
+            if(get_entry(entries, index_str + "velocity_min", value)) trigger.velocity_min = value;
+            if(get_entry(entries, index_str + "velocity_max", value)) trigger.velocity_max = value;
+            if(get_entry(entries, index_str + "curve"       , value)) trigger.curve        = value;
+            if(get_entry(entries, index_str + "pulse_width" , value)) trigger.pulse_width  = value;
+            if(get_entry(entries, index_str + "name"        , value)) trigger.name         = static_cast<std::string>(value);
+            map->set_trigger(trigger);
+        }
+        return map;
+    }
+
+    // Compile a mapping from a Max dictionary, on the main thread
+    static std::shared_ptr<TriggerMap> from_dictionary(c74::max::t_dictionary* d) {
+        return from_entries(read_entries(d));
+    }
+
+    // Triggers
+    void set_trigger(const DrumTrigger& trigger) { 
+        if(trigger.pitch_in < 0 || trigger.pitch_in > 127) return;
+        m_triggers[trigger.pitch_in] = trigger; 
+    }
+    const DrumTrigger* get_trigger(int pitch_in) const {
+        if(pitch_in < 0 || pitch_in > 127) return nullptr;
+        return m_triggers[pitch_in].isValid() ? &m_triggers[pitch_in] : nullptr;
+    }
+    void clear_triggers() { 
+        for(auto& trigger : m_triggers) trigger = DrumTrigger(); 
+    }
+    int num_triggers() const {
+        return std::count_if(std::begin(m_triggers), std::end(m_triggers), [](const DrumTrigger& t) { return t.isValid(); });
+    }
+
+    // Time offsets in ms
+    void set_time_offset(int pitch, double offset_ms) { 
+        if(pitch < 0 || pitch > 127) return;
+        m_time_offsets[pitch] = offset_ms; 
+    }
+    double get_time_offset(int pitch) const { 
+        if(pitch < 0 || pitch > 127) return 0.0;
+        return m_time_offsets[pitch]; 
+    }
+    void clear_time_offsets() { 
+        for(auto& offset : m_time_offsets) offset = 0.0; 
+    }
+
+    // Velocity dependent time offsets in ms, added to the time offset of the pitch
+    void set_velocity_offset(int pitch, int bucket, double offset_ms) {
+        if(pitch < 0 || pitch > 127 || bucket < 0 || bucket >= c_velocity_buckets) return;
+        m_velocity_offsets[pitch][bucket] = offset_ms;
+    }
+    double get_velocity_offset(int pitch, int bucket) const {
+        if(pitch < 0 || pitch > 127 || bucket < 0 || bucket >= c_velocity_buckets) return 0.0;
+        return m_velocity_offsets[pitch][bucket];
+    }
+    void clear_velocity_offsets() {
+        for(auto& offsets : m_velocity_offsets) {
+            for(auto& offset : offsets) offset = 0.0;
+        }
+    }
+
+    // The time offset in ms for a pitch played at a velocity. 
+    // The velocity offset is interpolated linearly between the centers of the buckets.
+    double get_time_offset(int pitch, int velocity) const {
+        if(pitch < 0 || pitch > 127) return 0.0;
+        const double* offsets = m_velocity_offsets[pitch];
+
+        const double bucket_size = 128.0 / c_velocity_buckets;
+        double position = (velocity - (bucket_size - 1.0) / 2.0) / bucket_size;
+        if(position <= 0.0) return m_time_offsets[pitch] + offsets[0];
+        if(position >= c_velocity_buckets - 1) return m_time_offsets[pitch] + offsets[c_velocity_buckets - 1];
+
+        int bucket = static_cast<int>(position);
+        double fraction = position - bucket;
+        return m_time_offsets[pitch] + offsets[bucket] + (offsets[bucket + 1] - offsets[bucket]) * fraction;
+    }
+
+    // Stream operator to print the trigger map
+    friend std::ostream& operator<<(std::ostream& os, const TriggerMap& map) {
+        os << "TriggerMap:(";
+        for(auto& trigger : map.m_triggers) {
+            if(trigger.isValid()) os << trigger << "," << map.m_time_offsets[trigger.pitch_in] << ",";
+        }
+        os << ")";
+        return os;
+    }
+
+private:
+    // The params with one value, per pitch
+    static constexpr const char* c_params[] = {"offset", "pitch_out", "velocity_min", "velocity_max", "curve", "pulse_width", "name"};
+
+    static bool get_entry(const Entries& entries, const std::string& key, atom& value) {
+        auto it = entries.find(key);
+        if(it == entries.end() || it->second.empty()) return false;
+        value = it->second[0];
+        return true;
+    }
+
+    DrumTrigger m_triggers[128];
+    double m_time_offsets[128] = {0.0};
+    double m_velocity_offsets[128][c_velocity_buckets] = {{0.0}};
+};
+
+
+// Runs trigger map compiles on one worker thread, off the main and scheduler threads. The thread is started by the first job.
+// A job that is posted while another runs waits for it, and replaces a job that has not started yet, so posting never blocks.
+class TriggerMapLoader {
+public:
+    using Job = std::function<void()>;
+
+    TriggerMapLoader() = default;
+    TriggerMapLoader(const TriggerMapLoader&) = delete;
+    TriggerMapLoader& operator=(const TriggerMapLoader&) = delete;
+
+    // Waits for the running job to finish
+    ~TriggerMapLoader() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        if(m_thread.joinable()) m_thread.join();
+    }
+
+    void post(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = std::move(job);
+            if(!m_thread.joinable()) m_thread = std::thread([this] { run(); });
+        }
+        m_wake.notify_one();
+    }
+
+private:
+    void run() {
+        for(;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this] { return m_stop || m_job; });
+                if(m_stop) return;
+                job = std::move(m_job);
+                m_job = nullptr;
+            }
+            job();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    Job m_job;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+
+// Sends drum hits as OSC bundles over UDP, directly to the robot controller.
+// All hits of one tick are batched into one bundle. Each hit is an OSC message:
+//   /trork/hit ,iift pitch_out velocity pulse_width timetag
+// Timing: the bundle itself is always sent with the immediate timetag (1), and is sent as soon as the hit is triggered,
+// which is already early by the time offset of the trigger map. The timetag argument of each hit is the NTP time at which
+// the controller should strike: the time the note sounds in Live plus the (negative) time offset of the trigger,
+// so the controller can schedule the strike without compensating for the mechanical latency again.
+class OscSender {
+public:
+    OscSender() = default;
+    ~OscSender() { close(); }
+
+    OscSender(const OscSender&) = delete;
+    OscSender& operator=(const OscSender&) = delete;
+
+    // Open a socket to send to host:port. Returns false on failure.
+    bool open(const std::string& host, int port) {
+        close();
+        if(port <= 0 || port > 65535) return false;
+
+#ifdef _WIN32
+        WSADATA wsa_data;
+        if(WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) return false;
+        m_wsa_started = true;
+#endif
+
+        std::memset(&m_address, 0, sizeof(m_address));
+        m_address.sin_family = AF_INET;
+        m_address.sin_port = htons(static_cast<unsigned short>(port));
+        if(inet_pton(AF_INET, host.c_str(), &m_address.sin_addr) != 1) {
+            close();
+            return false;
+        }
+
+        m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(m_socket == invalid_socket) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if(m_socket != invalid_socket) {
+#ifdef _WIN32
+            closesocket(m_socket);
+#else
+            ::close(m_socket);
+#endif
+            m_socket = invalid_socket;
+        }
+#ifdef _WIN32
+        if(m_wsa_started) WSACleanup();
+        m_wsa_started = false;
+#endif
+    }
+
+    bool is_open() const { return m_socket != invalid_socket; }
+
+    // Start a new bundle
+    void begin_bundle() {
+        m_buffer.clear();
+        m_num_hits = 0;
+        write_string("#bundle");
+        write_uint64(1);
+    }
+
+    // Add a hit to the bundle. The timetag is the time the controller should strike.
+    void add_hit(int pitch_out, int velocity, double pulse_width, uint64_t timetag) {
+        // Reserve space for the element size, which we know when the message is written
+        size_t size_pos = m_buffer.size();
+        write_int32(0);
+
+        write_string("/trork/hit");
+        write_string(",iift");
+        write_int32(pitch_out);
+        write_int32(velocity);
+        write_float(static_cast<float>(pulse_width));
+        write_uint64(timetag);
+
+        uint32_t size = static_cast<uint32_t>(m_buffer.size() - size_pos - 4);
+        for(int i=0; i<4; i++) m_buffer[size_pos + i] = static_cast<char>((size >> (24 - 8 * i)) & 0xFF);
+
+        m_num_hits++;
+    }
+
+    // Send the bundle if it contains any hits. Returns false if sending failed.
+    bool send_bundle() {
+        if(m_num_hits == 0 || !is_open()) return true;
+        auto sent = sendto(m_socket, m_buffer.data(), static_cast<int>(m_buffer.size()), 0, reinterpret_cast<const sockaddr*>(&m_address), sizeof(m_address));
+        m_num_hits = 0;
+        return sent == static_cast<decltype(sent)>(m_buffer.size());
+    }
+
+    int num_hits() const { return m_num_hits; }
+
+    // The NTP timetag for now + delay_ms
+    static uint64_t timetag_from_now(double delay_ms) {
+        // Seconds between the NTP epoch (1900) and the unix epoch (1970)
+        const uint64_t ntp_unix_offset = 2208988800ULL;
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        double seconds = std::chrono::duration<double>(now).count() + delay_ms / 1000.0;
+        double whole = std::floor(seconds);
+        uint64_t ntp_seconds = static_cast<uint64_t>(whole) + ntp_unix_offset;
+        uint64_t ntp_fraction = static_cast<uint64_t>((seconds - whole) * 4294967296.0);
+        return (ntp_seconds << 32) | (ntp_fraction & 0xFFFFFFFFULL);
+    }
+
+private:
+    // OSC data is big endian and padded to 4 bytes
+    void write_int32(int32_t value) {
+        uint32_t v = static_cast<uint32_t>(value);
+        for(int i=0; i<4; i++) m_buffer.push_back(static_cast<char>((v >> (24 - 8 * i)) & 0xFF));
+    }
+
+    void write_uint64(uint64_t value) {
+        for(int i=0; i<8; i++) m_buffer.push_back(static_cast<char>((value >> (56 - 8 * i)) & 0xFF));
+    }
+
+    void write_float(float value) {
+        int32_t v;
+        std::memcpy(&v, &value, sizeof(v));
+        write_int32(v);
+    }
+
+    void write_string(const char* str) {
+        size_t length = std::strlen(str);
+        m_buffer.insert(m_buffer.end(), str, str + length);
+        // At least one null terminator, then pad to a multiple of 4
+        do { m_buffer.push_back('\0'); } while(m_buffer.size() % 4 != 0);
+    }
+
+#ifdef _WIN32
+    using socket_type = SOCKET;
+    static constexpr socket_type invalid_socket = INVALID_SOCKET;
+    bool m_wsa_started = false;
+#else
+    using socket_type = int;
+    static constexpr socket_type invalid_socket = -1;
+#endif
+
+    socket_type       m_socket = invalid_socket;
+    sockaddr_in       m_address;
+    std::vector<char> m_buffer;
+    int               m_num_hits = 0;
+};
+
+
 class trork_drum_trigger : public object<trork_drum_trigger> {
 public:
     MIN_DESCRIPTION	{"Trigger the mechanic instruments before the noteevent actually occours in live to compensate for mechanical latency."};
@@ -296,12 +1021,17 @@ public:
     // Constructor
     trork_drum_trigger(const atoms& args = {}) {
         s_instances.insert(this);
+        s_bus.subscribe(this, notefication_type::playing_changed);
         setup_drum_triggers();
+
+        m_constructed = true;
+        open_udp(udp_host, udp_port);
     }
 
     // Destructor
     ~trork_drum_trigger() { 
         s_instances.erase(this); 
+        s_bus.unsubscribe_all(this);
     }
 
     // Notification types
@@ -310,13 +1040,6 @@ public:
         enum_count
     };
 
-    // Notify all instances of a change
-    static void notify_all(trork_drum_trigger* notifying_instance, notefication_type type) {
-        for (auto instance : s_instances){
-            instance->notify(notifying_instance, type);
-        }
-    }
-
     // Notify this instance of a change. Pass the type of change as an argument and also the instance that is notifying.
     void notify(trork_drum_trigger* notifying_instance, notefication_type type) {
         switch (type) {
@@ -332,7 +1055,10 @@ public:
     void playing_changed(trork_drum_trigger* notifying_instance)
     {
         bool is_playing = s_live_set.get_is_playing();
-        if(!is_playing) flush();
+        if(!is_playing) {
+            if(notifying_instance == this) edit_session([](SessionClips& session) { session.stop_all(); });
+            flush();
+        }
     }
 
     // Make inlets and outlets
@@ -372,6 +1098,37 @@ public:
         }}
     };
 
+    // Attribute for where the drum triggers are sent
+    // outlet: Only to the outlet. udp: Only as OSC over UDP. both: To the outlet and as OSC over UDP
+    enum class output_modes : int { outlet, udp, both, enum_count };
+    enum_map output_modes_range = {"outlet", "udp", "both"};
+    attribute<output_modes> output_mode { this, "output_mode", output_modes::outlet, output_modes_range,
+        description {"Choose where the drum triggers are sent. udp falls back to the outlet while no UDP socket is open."}
+    };
+
+    // The UDP attributes only open the socket once the object is constructed, as their setters also run for the
+    // default values while the members are constructed. The constructor opens the socket with the initial values.
+    bool m_constructed = false;
+
+    // Attribute for the host of the robot controller
+    attribute<symbol> udp_host {this, "udp_host", "127.0.0.1",
+        description {"IP address of the robot controller receiving OSC over UDP."},
+        setter {MIN_FUNCTION {
+            if(m_constructed) open_udp(args[0], udp_port);
+            return args;
+        }}
+    };
+
+    // Attribute for the port of the robot controller
+    attribute<int> udp_port {this, "udp_port", 0,
+        description {"UDP port of the robot controller receiving OSC. 0 disables the UDP output."},
+        range {0, 65535},  // Define a range for the parameter
+        setter {MIN_FUNCTION {
+            if(m_constructed) open_udp(udp_host, args[0]);
+            return args;
+        }}
+    };
+
     bool is_muted() {
         if(solo) return false;
         if(mute) return true;
@@ -379,20 +1136,33 @@ public:
         return false;
     }
 
-    void noteOn(Track::Clip::Note note) {
+    void noteOn(const Track::Clip::Note& note, const TriggerMap& trigger_map, OscSender* osc, double beats, double offset_ms) {
         // Play the note
         out1.send("note", note.pitch, note.velocity);
         
-        // If the m_drum_triggers contains a drum trigger with the same pitch_in as the note.pitch, we play the drum trigger. Use find_if
-        auto it = std::find_if(m_drum_triggers.begin(), m_drum_triggers.end(), [note](const DrumTrigger& drum_trigger) {
-            return drum_trigger.pitch_in == note.pitch;
-        });
+        // If the trigger map has a drum trigger for the note.pitch, we play the drum trigger
+        const DrumTrigger* trigger = trigger_map.get_trigger(note.pitch);
+        if(!trigger) return;
+
+        // Add the hit to the bundle of this tick, timestamped with the time to strike
+        if(output_mode != output_modes::outlet && osc) {
+            double delay_ms = (note.start_time - beats) * 60000.0 / s_live_set.get_tempo() + offset_ms;
+            if(delay_ms < 0.0) delay_ms = 0.0;
+            osc->add_hit(trigger->pitch_out, trigger->get_velocity(note.velocity), trigger->pulse_width, OscSender::timetag_from_now(delay_ms));
+        }
 
-        // A matching drum trigger was found
-        if(it != m_drum_triggers.end()) {
-            out1.send("trig", it->pitch_out, it->get_velocity(note.velocity));
+        if(output_mode == output_modes::udp) {
+            if(osc) return;
+            // Without a socket the hits fall back to the outlet, instead of being lost
+            if(!m_udp_warned.exchange(true)) cerr << "Warning: output_mode is udp but no UDP socket is open, the drum triggers are sent to the outlet." << endl;
         }
 
+        if(trigger->pulse_width > 0.0) {
+            out1.send("trig", trigger->pitch_out, trigger->get_velocity(note.velocity), trigger->pulse_width);
+        }
+        else {
+            out1.send("trig", trigger->pitch_out, trigger->get_velocity(note.velocity));
+        }
     }
 
     void noteOff(Track::Clip::Note note) {
@@ -402,47 +1172,71 @@ public:
 
 
     // The playing position in the Live Set, in beats.
-    message<threadsafe::yes> number { this, "number", "The playing position in the Live Set, in beats.", 
-        MIN_FUNCTION {
-            s_live_set.set_beats(static_cast<double>(args[0]) - offset);
-
-            if(is_muted()) return {};
-
-            // Print the notes between last_beats and beats
-            double last_beats = s_live_set.get_last_beats();
-            double beats = s_live_set.get_beats();
-
-
-            for(auto& note : s_track.m_notes)
-            {   
-                // Get a pointer to the track note
-                auto note_ptr = &note;
-
-                // Initialize offset_beats to 0.0
-                double offset_beats = 0.0;
-                double offset_ms = m_time_offsets[note.pitch];
-                
-                // If the offset_ms is not 0.0, we calculate the offset_beats
-                if(offset_ms != 0.0) offset_beats = offset_ms / 60000.0 * s_live_set.get_tempo();
-                
-                // Check if the note should play
-                bool noteShouldPlay = note.playing(beats, offset_beats);
-                bool noteIsPlaying = s_track.m_playing_note_ptrs.find(note_ptr) != s_track.m_playing_note_ptrs.end();
-                if(noteShouldPlay && !noteIsPlaying) {
-                    // Play the note
-                    s_track.m_playing_note_ptrs.insert(note_ptr);
-                    noteOn(note);
-                }
-                else if(!noteShouldPlay && noteIsPlaying) {
-                    // Stop the note
-                    s_track.m_playing_note_ptrs.erase(note_ptr);
-                    noteOff(note);
-                }            
-            }
+    message<threadsafe::yes> number { this, "number", "The playing position in the Live Set, in beats. Ignored when the transport is itm.", 
+        MIN_FUNCTION {
+            if(transport == transport_modes::itm) return {};
+            tick(static_cast<double>(args[0]) - offset);
             return {};
         }  
     };
 
+    // Play the notes at the playing position, from the number message or the ITM
+    void tick(double a_beats) {
+        s_live_set.set_beats(a_beats);
+
+        if(is_muted()) return;
+
+        // Print the notes between last_beats and beats
+        double last_beats = s_live_set.get_last_beats();
+        double beats = s_live_set.get_beats();
+
+        // Take the trigger map and the session clips once per tick, so what is swapped in meanwhile is used from the next tick
+        const auto trigger_map = get_trigger_map();
+        const auto session = get_session();
+
+        // Collect the hits of this tick in one OSC bundle. The sender is taken once per tick, like the trigger map.
+        const auto osc = get_osc();
+        if(osc) osc->begin_bundle();
+
+        // Bake the time offsets of the notes, when the track or the trigger map has changed
+        if(m_baked_map != trigger_map || m_baked_version != s_track.m_version) bake_time_offsets(trigger_map);
+
+        for(size_t i=0; i<s_track.m_notes.size(); i++)
+        {   
+            auto& note = s_track.m_notes[i];
+
+            // Get a pointer to the track note
+            auto note_ptr = &note;
+
+            // Initialize offset_beats to 0.0
+            double offset_beats = 0.0;
+            double offset_ms = m_note_offsets[i];
+            
+            // If the offset_ms is not 0.0, we calculate the offset_beats
+            if(offset_ms != 0.0) offset_beats = offset_ms / 60000.0 * s_live_set.get_tempo();
+            
+            // Check if the note should play. A playing session clip replaces the arrangement.
+            bool noteShouldPlay = note.playing(beats, offset_beats) && !session->covers(note.start_time);
+            bool noteIsPlaying = s_track.m_playing_note_ptrs.find(note_ptr) != s_track.m_playing_note_ptrs.end();
+            if(noteShouldPlay && !noteIsPlaying) {
+                // Play the note
+                s_track.m_playing_note_ptrs.insert(note_ptr);
+                noteOn(note, *trigger_map, osc.get(), beats, offset_ms);
+            }
+            else if(!noteShouldPlay && noteIsPlaying) {
+                // Stop the note
+                s_track.m_playing_note_ptrs.erase(note_ptr);
+                noteOff(note);
+            }            
+        }
+
+        // Play the session clips
+        play_session_notes(*session, *trigger_map, osc.get(), beats);
+
+        // Send the hits of this tick
+        if(osc && !osc->send_bundle()) cerr << "Error: could not send the OSC bundle to " << udp_host << ":" << udp_port << endl;
+    }
+
     // Flush all the playing notes
     message<> flush { this, "flush", "Flush all the playing notes.",
         MIN_FUNCTION {
@@ -450,6 +1244,12 @@ public:
                 out1.send("note", note_ptr->pitch, 0);
             }
             s_track.m_playing_note_ptrs.clear();
+
+            for(auto& session_note : m_session_notes) {
+                if(session_note.playing) out1.send("note", session_note.note.pitch, 0);
+            }
+            m_session_notes.clear();
+            m_session_version = -1;
             return {};
         }  
     };    
@@ -457,7 +1257,7 @@ public:
     // Set Offset for a given pitch
     message<> set_time_offset { this, "set_time_offset", "Set the time offset in ms for a given pitch. Negative values will play the note earlier.",
         MIN_FUNCTION {
-            m_time_offsets[args[0]] = args[1];
+            edit_trigger_map([&args](TriggerMap& map) { map.set_time_offset(args[0], args[1]); });
             return {};
         }  
     };
@@ -465,8 +1265,63 @@ public:
     // Cleat time offsets
     message<> clear_time_offsets { this, "clear_time_offsets", "Clear the time offsets.",
         MIN_FUNCTION {
+            edit_trigger_map([](TriggerMap& map) { map.clear_time_offsets(); });
+            return {};
+        }  
+    };
+
+    // Set the velocity dependent time offsets for a given pitch
+    message<> set_velocity_offsets { this, "set_velocity_offsets", "Set the velocity dependent time offsets in ms for a given pitch. They are added to the time offset of the pitch. args: pitch, followed by one offset per velocity bucket (0-15, 16-31, ... 112-127). Negative values will play the note earlier.",
+        MIN_FUNCTION {
+            if(args.size() < 2) {
+                cerr << "Error: set_velocity_offsets message requires a pitch and at least one offset." << endl;
+                return {};
+            }
+            edit_trigger_map([&args](TriggerMap& map) {
+                for(int b=0; b+1<args.size() && b<TriggerMap::c_velocity_buckets; b++) {
+                    map.set_velocity_offset(args[0], b, args[b+1]);
+                }
+            });
+            return {};
+        }  
+    };
+
+    // Clear the velocity dependent time offsets
+    message<> clear_velocity_offsets { this, "clear_velocity_offsets", "Clear the velocity dependent time offsets.",
+        MIN_FUNCTION {
+            edit_trigger_map([](TriggerMap& map) { map.clear_velocity_offsets(); });
+            return {};
+        }  
+    };
+
+    // Get the time offset for a given pitch and velocity
+    message<> get_time_offset { this, "get_time_offset", "Output the time offset in ms for a given pitch and drive velocity. args: pitch, velocity",
+        MIN_FUNCTION {
+            if(args.size() != 2) {
+                cerr << "Error: get_time_offset message requires two arguments: pitch and velocity." << endl;
+                return {};
+            }
+            int pitch = args[0];
+            int velocity = args[1];
+            out1.send("time_offset", pitch, velocity, get_trigger_map()->get_time_offset(pitch, velocity));
+            return {};
+        }  
+    };
+
+    // Print the velocity dependent time offsets
+    message<> print_velocity_offsets { this, "print_velocity_offsets", "Print the velocity dependent time offsets of the pitches that have them.",
+        MIN_FUNCTION {
+            const auto trigger_map = get_trigger_map();
+            cout << "Velocity Offsets:" << endl;
             for(int i=0; i<128; i++) {
-                m_time_offsets[i] = 0.0;
+                std::stringstream line;
+                bool has_offsets = false;
+                for(int b=0; b<TriggerMap::c_velocity_buckets; b++) {
+                    double offset = trigger_map->get_velocity_offset(i, b);
+                    if(offset != 0.0) has_offsets = true;
+                    line << " " << offset;
+                }
+                if(has_offsets) cout << i << ":" << line.str() << endl;
             }
             return {};
         }  
@@ -475,31 +1330,79 @@ public:
     // Print the time offsets
     message<> print_time_offsets { this, "print_time_offsets", "Print the time offsets.",
         MIN_FUNCTION {
+            const auto trigger_map = get_trigger_map();
             cout << "Time Offsets:" << endl;
             for(int i=0; i<128; i++) {
-                cout << i << ": " << m_time_offsets[i] << endl;
+                cout << i << ": " << trigger_map->get_time_offset(i) << endl;
             }
             return {};
         }  
     };
 
     // Is Live's transport is running?
-    message<threadsafe::yes> playing { this, "playing", "Is Live's transport is running?",
+    message<threadsafe::yes> playing { this, "playing", "Is Live's transport is running? Ignored when the transport is itm.",
         MIN_FUNCTION {
+            if(transport == transport_modes::itm) return {};
             s_live_set.set_is_playing(args[0]);
-            notify_all(this, notefication_type::playing_changed); 
+            s_bus.notify(this, notefication_type::playing_changed);
             return {};
         }  
     };
 
     // Set the tempo of the Live Set
-    message<threadsafe::yes> tempo { this, "tempo", "Set the tempo of the Live Set.",
+    message<threadsafe::yes> tempo { this, "tempo", "Set the tempo of the Live Set. Ignored when the transport is itm.",
         MIN_FUNCTION {
+            if(transport == transport_modes::itm) return {};
             s_live_set.set_tempo(args[0]);
             return {};
         }  
     };
 
+    // Read the transport from the ITM, on the scheduler at the transport_interval
+    timer<> itm_poll { this,
+        MIN_FUNCTION {
+            if(transport != transport_modes::itm) return {};
+            poll_itm();
+            itm_poll.delay(transport_interval);
+            return {};
+        }
+    };
+
+    // Attribute for where the transport comes from
+    enum class transport_modes : int { messages, itm, enum_count };
+    enum_map transport_modes_range = {"messages", "itm"};
+    attribute<transport_modes> transport { this, "transport", transport_modes::messages, transport_modes_range,
+        description {"messages follows the number, tempo and playing messages from the Live observers. "
+                     "itm reads the position, tempo and transport state directly from Live's ITM, every transport_interval ms."},
+        setter {MIN_FUNCTION {
+            transport_modes mode = static_cast<transport_modes>(static_cast<int>(args[0]));
+            if(mode == transport_modes::itm) itm_poll.delay(0);
+            else                             itm_poll.stop();
+            return args;
+        }}
+    };
+
+    attribute<double> transport_interval {this, "transport_interval", 2.0,
+        description {"How often the ITM is read in ms, when the transport is itm. Hits are placed no finer than this."},
+        range {1.0, 100.0}
+    };
+
+    // Follow the ITM like the number, tempo and playing messages would
+    void poll_itm() {
+        if(!m_itm.read()) return;
+
+        s_live_set.set_tempo(m_itm.tempo);
+        if(m_itm.playing != s_live_set.get_is_playing()) {
+            s_live_set.set_is_playing(m_itm.playing);
+            s_bus.notify(this, notefication_type::playing_changed);
+        }
+
+        // Only tick when the position has moved, like the observer only sends number when it changes
+        if(m_itm.beats == m_itm_beats) return;
+        m_itm_beats = m_itm.beats;
+        tick(m_itm.beats - offset);
+    }
+
     // message to clear the clips
     message<> clear_clips { this, "clear_clips", "Clear the clips.",
         MIN_FUNCTION {
@@ -516,6 +1419,133 @@ public:
         }  
     };
 
+    // message to add a clip with its content hash
+    message<> add_clip_hashed { this, "add_clip_hashed", "Add a clip and store it in the timeline cache. args: hash, followed by the add_clip arguments.",
+        MIN_FUNCTION {
+            if(args.size() < 11) {
+                cerr << "Error: add_clip_hashed message requires a hash followed by the add_clip arguments." << endl;
+                return {};
+            }
+            s_track.from_atoms(atoms(args.begin() + 1, args.end()), args[0], false);
+            return {};
+        }  
+    };
+
+    // message to add a clip from the timeline cache
+    message<> add_cached_clip { this, "add_cached_clip", "Add a clip from the timeline cache. args: hash",
+        MIN_FUNCTION {
+            if(args.size() != 1) {
+                cerr << "Error: add_cached_clip message requires one argument: hash." << endl;
+                return {};
+            }
+            // Let NoteTracker.js know, so it sends the whole clip
+            if(!s_track.from_cache(args[0], false)) out1.send("timeline_cache", "missing", args[0]);
+            return {};
+        }  
+    };
+
+    // message to end a batch of hashed and cached clips
+    message<> clips_done { this, "clips_done", "All clips are added. Collects the track notes and writes the timeline cache file, if set.",
+        MIN_FUNCTION {
+            s_track.collect_track_notes();
+            if(!timeline_path({}).empty()) write_timeline();
+            return {};
+        }  
+    };
+
+    // Attribute for the timeline cache file
+    attribute<symbol> timeline_file {this, "timeline_file", "",
+        description {"File for the timeline cache. Used by read_timeline and write_timeline when called without a path, and written on clips_done."}
+    };
+
+    // message to read the timeline cache file
+    message<> read_timeline { this, "read_timeline", "Read the timeline cache file and output the hashes of the cached clips. Sent by NoteTracker.js at load. args: optional file path",
+        MIN_FUNCTION {
+            // NoteTracker.js sends read_timeline at load, so without a timeline file there is just nothing cached
+            std::string path = timeline_path(args);
+            if(path.empty()) return {};
+
+            int num_clips = TimelineFile::read(path, s_track.m_cache);
+            if(num_clips < 0) {
+                cerr << "Could not read the timeline cache: " << path << endl;
+                return {};
+            }
+
+            // Output the hashes, NoteTracker.js will only re-send clips that are not in the cache
+            atoms res;
+            res.push_back("timeline_cache");
+            res.push_back("hashes");
+            for(auto& entry : s_track.m_cache) res.push_back(entry.first);
+            out1.send(res);
+
+            return {};
+        }  
+    };
+
+    // message to write the timeline cache file
+    message<> write_timeline { this, "write_timeline", "Write the clips of the track to the timeline cache file. args: optional file path",
+        MIN_FUNCTION {
+            std::string path = timeline_path(args);
+            if(path.empty()) {
+                cerr << "Error: write_timeline needs a file path or the timeline_file attribute." << endl;
+                return {};
+            }
+
+            if(TimelineFile::write(path, s_track.m_clips) < 0) {
+                cerr << "Could not write the timeline cache: " << path << endl;
+            }
+            return {};
+        }  
+    };
+
+    // message to clear the session clips
+    message<> clear_session_clips { this, "clear_session_clips", "Clear the session clips.",
+        MIN_FUNCTION {
+            edit_session([](SessionClips& session) { session.clear(); });
+            return {};
+        }  
+    };
+
+    // message to add a session clip
+    message<> add_session_clip { this, "add_session_clip", "Add the clip of a session clip slot. args: slot index, followed by the add_clip arguments.",
+        MIN_FUNCTION {
+            if(args.size() < 11) {
+                cerr << "Error: add_session_clip message requires a slot index followed by the add_clip arguments." << endl;
+                return {};
+            }
+            Track::Clip clip(args[1], args[2], args[3], args[4], args[5], args[6], args[7], args[8], args[9], args[10]);
+            for(int i=11; i+3<args.size(); i+=4) {
+                clip.add_note(args[i], args[i+1], args[i+2], args[i+3], false);
+            }
+            edit_session([&args, &clip](SessionClips& session) { session.set_clip(args[0], clip); });
+            return {};
+        }  
+    };
+
+    // message to launch a session clip
+    message<> launch_session_clip { this, "launch_session_clip", "A session clip was launched. It starts at the next multiple of the launch quantisation. args: slot index, launch quantisation in beats (0 for none)",
+        MIN_FUNCTION {
+            if(args.size() != 2) {
+                cerr << "Error: launch_session_clip message requires two arguments: slot index and launch quantisation in beats." << endl;
+                return {};
+            }
+            int slot = args[0];
+            double beat = next_launch_beat(args[1]);
+            edit_session([slot, beat](SessionClips& session) { session.launch(slot, beat); });
+            return {};
+        }  
+    };
+
+    // message to stop the session clip
+    message<> stop_session_clip { this, "stop_session_clip", "The session clip was stopped. It stops at the next multiple of the launch quantisation. args: launch quantisation in beats (0 for none)",
+        MIN_FUNCTION {
+            double quantisation = args.empty() ? 0.0 : static_cast<double>(args[0]);
+            double beat = next_launch_beat(quantisation);
+            edit_session([beat](SessionClips& session) { session.stop(beat); });
+            return {};
+        }  
+    };
+
     // message to print the clips
     message<> print_clips { this, "print_clips", "Print the clips.",
         MIN_FUNCTION {
@@ -539,8 +1569,10 @@ public:
     // Setup a single Drum Trigger
     message<> setup_drum_trigger { this, "setup_drum_trigger", "Setup a single drum trigger. args: pitch_in, pitch_out, velocity_min, velocity_max, delay, name",
         MIN_FUNCTION {
-            m_drum_triggers.insert(DrumTrigger{args[0], args[1], args[2], args[3], args[5]});
-            m_time_offsets[args[0]] = args[4];
+            edit_trigger_map([&args](TriggerMap& map) {
+                map.set_trigger(DrumTrigger{args[0], args[1], args[2], args[3], args[5]});
+                map.set_time_offset(args[0], args[4]);
+            });
             return {};
         }  
     };
@@ -548,19 +1580,80 @@ public:
     // Setup Drum Trigger
     message<> setup_drum_triggers { this, "setup_drum_triggers", "Setup the drum trigger.",
         MIN_FUNCTION {
-            m_drum_triggers.clear();
-            m_drum_triggers.insert(DrumTrigger{36, 36, 35, 80, "TopDrum" }); m_time_offsets[36] = -40;
-            m_drum_triggers.insert(DrumTrigger{38, 37, 50, 90, "SideDrum"}); m_time_offsets[38] = -65;
-            m_drum_triggers.insert(DrumTrigger{51, 38, 20, 40, "Frog"    }); m_time_offsets[51] = -35;
-            m_drum_triggers.insert(DrumTrigger{41, 40, 10, 30, "Cabasa"  }); m_time_offsets[41] = -15;
-            m_drum_triggers.insert(DrumTrigger{40, 39, 10, 30, "Cabasa2" }); m_time_offsets[40] = -15;
+            // Build the complete map before it is published, the tick path never sees a partial map
+            auto map = std::make_shared<TriggerMap>(*get_trigger_map());
+            map->clear_triggers();
+            map->set_trigger(DrumTrigger{36, 36, 35, 80, "TopDrum" }); map->set_time_offset(36, -40);
+            map->set_trigger(DrumTrigger{38, 37, 50, 90, "SideDrum"}); map->set_time_offset(38, -65);
+            map->set_trigger(DrumTrigger{51, 38, 20, 40, "Frog"    }); map->set_time_offset(51, -35);
+            map->set_trigger(DrumTrigger{41, 40, 10, 30, "Cabasa"  }); map->set_time_offset(41, -15);
+            map->set_trigger(DrumTrigger{40, 39, 10, 30, "Cabasa2" }); map->set_time_offset(40, -15);
+            set_trigger_map(map);
             return {};
         }  
     };
     // Clear Drum Triggers
     message<> clear_drum_triggers { this, "clear_drum_triggers", "Clear the drum triggers.",
         MIN_FUNCTION {
-            m_drum_triggers.clear();
+            edit_trigger_map([](TriggerMap& map) { map.clear_triggers(); });
+            return {};
+        }  
+    };
+
+    // Load a complete trigger map from a named Max dict
+    message<> load_trigger_map { this, "load_trigger_map", "Load a complete trigger map from a named dict. The map is compiled on a separate thread and swapped in when done. args: dict name",
+        MIN_FUNCTION {
+            if(args.size() != 1) {
+                cerr << "Error: load_trigger_map message requires one argument: dict name." << endl;
+                return {};
+            }
+
+            symbol name = args[0];
+            c74::max::t_dictionary* d = c74::max::dictobj_findregistered_retain(name);
+            if(!d) {
+                cerr << "Error: load_trigger_map could not find the dict: " << name << endl;
+                return {};
+            }
+            auto entries = TriggerMap::read_entries(d);
+            c74::max::dictobj_release(d);
+
+            compile_trigger_map(name, std::move(entries));
+            return {};
+        }  
+    };
+
+    // Read a complete trigger map from a JSON file
+    message<> read_trigger_map { this, "read_trigger_map", "Read a complete trigger map from a JSON file. The map is compiled on a separate thread and swapped in when done. args: absolute file path",
+        MIN_FUNCTION {
+            if(args.size() != 1) {
+                cerr << "Error: read_trigger_map message requires one argument: file path." << endl;
+                return {};
+            }
+
+            std::string file_path = args[0];
+            char filename[c74::max::MAX_FILENAME_CHARS] = {0};
+            short path_id = 0;
+            if(c74::max::path_frompathname(file_path.c_str(), &path_id, filename) != 0) {
+                cerr << "Error: read_trigger_map could not find the file: " << file_path << endl;
+                return {};
+            }
+            c74::max::t_dictionary* d = nullptr;
+            if(c74::max::dictionary_read(filename, path_id, &d) != 0 || !d) {
+                cerr << "Error: read_trigger_map could not read the file: " << file_path << endl;
+                return {};
+            }
+            auto entries = TriggerMap::read_entries(d);
+            c74::max::object_free(d);
+
+            compile_trigger_map(symbol(file_path), std::move(entries));
+            return {};
+        }  
+    };
+
+    // Print the trigger map
+    message<> print_trigger_map { this, "print_trigger_map", "Print the current trigger map.",
+        MIN_FUNCTION {
+            cout << *get_trigger_map() << endl;
             return {};
         }  
     };
@@ -570,6 +1663,9 @@ private:
 
     // Static list of all instances of the class
     static std::set<trork_drum_trigger*> s_instances;
+
+    // The notifications the instances have subscribed to
+    static NotificationBus<trork_drum_trigger, notefication_type> s_bus;
     
     // Static Track
     static Track s_track;
@@ -577,21 +1673,225 @@ private:
     // A structure to hold information about the live set
     static LiveSet s_live_set;
 
-    // A note offset for each pitch
-    double m_time_offsets[128] = {0.0};
+    // Get the current trigger map. Safe to call from any thread.
+    std::shared_ptr<const TriggerMap> get_trigger_map() const {
+        return std::atomic_load(&m_trigger_map);
+    }
+
+    // Publish a new trigger map. The tick path picks it up on its next tick.
+    void set_trigger_map(std::shared_ptr<const TriggerMap> map) {
+        std::atomic_store(&m_trigger_map, std::move(map));
+    }
+
+    // Edit a copy of the current trigger map and publish it
+    template<class F>
+    void edit_trigger_map(F edit) {
+        auto map = std::make_shared<TriggerMap>(*get_trigger_map());
+        edit(*map);
+        set_trigger_map(map);
+    }
 
-    // Pitch Remapping for Drums
-    std::set<DrumTrigger> m_drum_triggers = {};
+    // Get the current session clips. Safe to call from any thread.
+    static std::shared_ptr<const SessionClips> get_session() {
+        return std::atomic_load(&s_session);
+    }
+
+    // Edit a copy of the current session clips and publish it. The session is edited from the main thread and,
+    // when the transport stops, from the thread that reads the transport, so a concurrent edit is retried.
+    template<class F>
+    static void edit_session(F edit) {
+        auto current = get_session();
+        std::shared_ptr<const SessionClips> session;
+        do {
+            auto copy = std::make_shared<SessionClips>(*current);
+            edit(*copy);
+            session = copy;
+        } while(!std::atomic_compare_exchange_weak(&s_session, &current, session));
+    }
+
+    // The native path of the timeline cache file, from the message arguments or the timeline_file attribute
+    std::string timeline_path(const atoms& args) {
+        symbol file = args.empty() ? static_cast<symbol>(timeline_file) : static_cast<symbol>(args[0]);
+        std::string max_path = file;
+        if(max_path.empty()) return max_path;
+
+        // Convert the Max path to a native path for the file system
+        char native[c74::max::MAX_PATH_CHARS] = {0};
+        if(c74::max::path_nameconform(max_path.c_str(), native, c74::max::PATH_STYLE_NATIVE, c74::max::PATH_TYPE_ABSOLUTE) != 0) return max_path;
+        return native;
+    }
+
+    // (Re)open the UDP socket to the robot controller. A new sender is opened and swapped in, so the tick keeps
+    // using the sender it took until it is done, and the old socket is closed when the last tick releases it.
+    void open_udp(const symbol& host, int port) {
+        std::shared_ptr<OscSender> osc;
+        if(port != 0) {
+            osc = std::make_shared<OscSender>();
+            if(!osc->open(host, port)) {
+                cerr << "Error: could not open UDP socket to " << host << ":" << port << endl;
+                osc = nullptr;
+            }
+        }
+        std::atomic_store(&m_osc, osc);
+        m_udp_warned = false;
+    }
+
+    // Get the open OSC sender, or nullptr. Safe to call from any thread.
+    std::shared_ptr<OscSender> get_osc() const {
+        return std::atomic_load(&m_osc);
+    }
+
+    // The beat at which a launch happens: the next multiple of the quantisation
+    static double next_launch_beat(double quantisation) {
+        double beats = s_live_set.get_beats();
+        if(quantisation <= 0.0) return beats;
+        return std::ceil(beats / quantisation - 1e-9) * quantisation;
+    }
+
+    // Play the notes of the session clips. The notes are generated lazily up to a horizon, which is as far ahead
+    // as the earliest time offset, so the first hits of a clip that is launched with quantisation can be played early.
+    void play_session_notes(const SessionClips& session, const TriggerMap& trigger_map, OscSender* osc, double beats) {
+        const double tempo = s_live_set.get_tempo();
+
+        // When the clips or launches have changed, or the transport jumped back, we generate the notes again
+        if(m_session_version != session.version() || beats < m_session_generated_until - m_session_lookahead - 1.0) {
+            m_session_notes.erase(std::remove_if(m_session_notes.begin(), m_session_notes.end(), [](const SessionClips::SessionNote& n) { return !n.playing; }), m_session_notes.end());
+            m_session_generated_until = beats;
+            m_session_version = session.version();
+        }
+
+        m_session_lookahead = m_max_early_ms / 60000.0 * tempo;
+        double horizon = beats + m_session_lookahead;
+        if(horizon > m_session_generated_until) {
+            std::vector<SessionClips::SessionNote> new_notes;
+            session.collect(m_session_generated_until, horizon, new_notes);
+            for(auto& new_note : new_notes) {
+                // A note that is still playing from before the notes were generated again, is not added twice
+                bool exists = std::any_of(m_session_notes.begin(), m_session_notes.end(), [&new_note](const SessionClips::SessionNote& n) { return n.key == new_note.key; });
+                if(!exists) m_session_notes.push_back(new_note);
+            }
+            m_session_generated_until = horizon;
+        }
 
+        for(auto& session_note : m_session_notes) {
+            const auto& note = session_note.note;
+            const DrumTrigger* trigger = trigger_map.get_trigger(note.pitch);
+            double offset_ms = trigger_map.get_time_offset(note.pitch, trigger ? trigger->get_velocity(note.velocity) : note.velocity);
+            bool noteShouldPlay = note.playing(beats, offset_ms / 60000.0 * tempo);
+
+            if(noteShouldPlay && !session_note.playing) {
+                session_note.playing = true;
+                noteOn(note, trigger_map, osc, beats, offset_ms);
+            }
+            else if(!noteShouldPlay && session_note.playing) {
+                session_note.playing = false;
+                noteOff(note);
+            }
+        }
+
+        // Forget the notes that have been played
+        m_session_notes.erase(std::remove_if(m_session_notes.begin(), m_session_notes.end(), [beats](const SessionClips::SessionNote& n) {
+            return !n.playing && n.note.start_time + n.note.duration < beats;
+        }), m_session_notes.end());
+    }
+
+    // Compute the time offset of every track note from its pitch and drive velocity.
+    // The drive velocity is the velocity sent to the instrument, so the scaled velocity if the pitch has a trigger.
+    void bake_time_offsets(const std::shared_ptr<const TriggerMap>& trigger_map) {
+        m_note_offsets.resize(s_track.m_notes.size());
+        for(size_t i=0; i<s_track.m_notes.size(); i++) {
+            const auto& note = s_track.m_notes[i];
+            const DrumTrigger* trigger = trigger_map->get_trigger(note.pitch);
+            int velocity = trigger ? trigger->get_velocity(note.velocity) : note.velocity;
+            m_note_offsets[i] = trigger_map->get_time_offset(note.pitch, velocity);
+        }
+        m_baked_map = trigger_map;
+        m_baked_version = s_track.m_version;
+
+        // The earliest offset decides how far ahead the session notes are generated
+        m_max_early_ms = 0.0;
+        for(int pitch=0; pitch<128; pitch++) {
+            for(int b=0; b<TriggerMap::c_velocity_buckets; b++) {
+                double offset = trigger_map->get_time_offset(pitch) + trigger_map->get_velocity_offset(pitch, b);
+                if(-offset > m_max_early_ms) m_max_early_ms = -offset;
+            }
+        }
+    }
+
+    // Compile the entries of a trigger map on the loader thread and swap the map in. 
+    // The loaded queue reports it on the main thread.
+    void compile_trigger_map(symbol name, TriggerMap::Entries entries) {
+        m_loader.post([this, name, entries = std::move(entries)]() {
+            auto map = TriggerMap::from_entries(entries);
+            set_trigger_map(map);
+            {
+                std::lock_guard<std::mutex> lock(m_loaded_mutex);
+                m_loaded.push_back({name, map->num_triggers()});
+            }
+            loaded_queue.set();
+        });
+    }
+
+    // Report the compiled trigger maps, on the main thread
+    queue<> loaded_queue { this,
+        MIN_FUNCTION {
+            std::vector<std::pair<symbol, int>> loaded;
+            {
+                std::lock_guard<std::mutex> lock(m_loaded_mutex);
+                loaded.swap(m_loaded);
+            }
+            for(const auto& map : loaded) out1.send("trigger_map", "loaded", map.first, map.second);
+            return {};
+        }
+    };
+
+    // Pitch Remapping and time offsets for Drums. Swapped atomically as a whole.
+    std::shared_ptr<const TriggerMap> m_trigger_map = std::make_shared<TriggerMap>();
+
+    // The time offset in ms of every track note, baked from the trigger map
+    std::vector<double> m_note_offsets;
+    std::shared_ptr<const TriggerMap> m_baked_map;
+    long m_baked_version = -1;
+    double m_max_early_ms = 0.0;
+
+    // Static Session Clips. Swapped atomically as a whole, like the trigger map.
+    static std::shared_ptr<const SessionClips> s_session;
+
+    // The generated session notes that are waiting to play or playing
+    std::vector<SessionClips::SessionNote> m_session_notes;
+    double m_session_generated_until = 0.0;
+    double m_session_lookahead = 0.0;
+    long   m_session_version = -1;
+
+    // The trigger maps that were compiled and are not reported yet, with their number of triggers
+    std::mutex m_loaded_mutex;
+    std::vector<std::pair<symbol, int>> m_loaded;
+
+    // Direct OSC output to the robot controller, nullptr when no socket is open. Swapped atomically like the trigger map.
+    std::shared_ptr<OscSender> m_osc;
+
+    // Was the missing socket in output_mode udp reported, since the socket was last opened
+    std::atomic<bool> m_udp_warned {false};
+
+    // The ITM, and the position that was read from it last
+    ItmTransport m_itm;
+    double m_itm_beats = -1.0;
+
+    // Compiles trigger maps off the scheduler and main threads. Last, so it is stopped before the members its jobs use.
+    TriggerMapLoader m_loader;
 };
 
 
 // Init Static variables
 std::set<trork_drum_trigger*> trork_drum_trigger::s_instances = {};
+NotificationBus<trork_drum_trigger, trork_drum_trigger::notefication_type> trork_drum_trigger::s_bus;
 
 // Init Track
 Track trork_drum_trigger::s_track = Track();
 
+// Init Session Clips
+std::shared_ptr<const SessionClips> trork_drum_trigger::s_session = std::make_shared<SessionClips>();
+
 
 // Init Static Beat
 LiveSet trork_drum_trigger::s_live_set = LiveSet();
@@ -5,6 +5,7 @@
 
 #include "c74_min_unittest.h"     // required unit test header
 #include "trork.drum-trigger.cpp"    // need the source of our object so that we can access it
+#include <future>
 
 // Unit tests are written using the Catch framework as described at
 // https://github.com/philsquared/Catch/blob/master/docs/tutorial.md
@@ -19,3 +20,184 @@ SCENARIO("object produces correct output") {
 
     }
 }
+
+SCENARIO("a trigger map is compiled from the entries of a dict on the loader thread") {
+
+    GIVEN("A dict with a mapped pitch and an offset for an unmapped pitch") {
+        dict d {symbol("drum-trigger-test-map")};
+        d["36-pitch_out"]    = 40;
+        d["36-velocity_min"] = 20;
+        d["36-velocity_max"] = 90;
+        d["36-offset"]       = -35.0;
+        d["36-name"]         = symbol("TopDrum");
+        d["38-offset"]       = -10.0;
+
+        auto entries = TriggerMap::read_entries(d);
+
+        WHEN("the entries are compiled") {
+            auto map = TriggerMap::from_entries(entries);
+
+            THEN("only the pitch with a pitch_out is mapped") {
+                REQUIRE((map->num_triggers() == 1));
+                const DrumTrigger* trigger = map->get_trigger(36);
+                REQUIRE((trigger != nullptr));
+                REQUIRE((trigger->pitch_out == 40));
+                REQUIRE((trigger->velocity_min == 20));
+                REQUIRE((trigger->velocity_max == 90));
+                REQUIRE((trigger->name == "TopDrum"));
+                REQUIRE((map->get_trigger(38) == nullptr));
+            }
+            THEN("the offsets are kept for mapped and unmapped pitches") {
+                REQUIRE((map->get_time_offset(36) == -35.0));
+                REQUIRE((map->get_time_offset(38) == -10.0));
+            }
+        }
+
+        WHEN("the entries are compiled on the loader") {
+            std::promise<int> compiled;
+            auto result = compiled.get_future();
+            {
+                TriggerMapLoader loader;
+                loader.post([&compiled, entries]() { compiled.set_value(TriggerMap::from_entries(entries)->num_triggers()); });
+                REQUIRE((result.wait_for(std::chrono::seconds(5)) == std::future_status::ready));
+            }
+
+            THEN("the job ran on the loader and the loader stopped") {
+                REQUIRE((result.get() == 1));
+            }
+        }
+    }
+}
+
+SCENARIO("the timeline cache keeps the clips that are added again after a clear") {
+
+    GIVEN("A track with two hashed clips") {
+        Track track;
+        track.from_atoms({1, "A", 0, 0.0, 4.0, 0.0, 4.0, 0, 0.0, 4.0, 36, 0.0, 1.0, 100}, "hash-a", false);
+        track.from_atoms({2, "B", 0, 4.0, 8.0, 0.0, 4.0, 0, 0.0, 4.0, 38, 0.0, 1.0, 100}, "hash-b", false);
+        track.collect_track_notes();
+
+        WHEN("the clips are cleared and only the first is added from the cache") {
+            track.clear();
+            REQUIRE(track.from_cache("hash-a"));
+
+            THEN("the first clip is back") {
+                REQUIRE((track.m_clips.size() == 1));
+                REQUIRE((track.m_notes.size() == 1));
+                REQUIRE((track.m_notes[0].pitch == 36));
+            }
+            THEN("the second clip is dropped from the cache by the next clear") {
+                track.clear();
+                REQUIRE(track.from_cache("hash-a", false));
+                REQUIRE_FALSE(track.from_cache("hash-b", false));
+            }
+        }
+
+        WHEN("the timeline file has a clip whose notes wrap around past the note count") {
+            const std::string path = "drum-trigger-test.tlcf";
+            REQUIRE((TimelineFile::write(path, track.m_clips) > 0));
+            {
+                std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+                TimelineFile::ClipRecord record;
+                file.seekg(sizeof(TimelineFile::Header));
+                file.read(reinterpret_cast<char*>(&record), sizeof(record));
+                record.first_note = 1;
+                record.num_notes = 0xFFFFFFFF;
+                file.seekp(sizeof(TimelineFile::Header));
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            }
+
+            THEN("the file is rejected") {
+                std::map<std::string, Track::Clip> cache;
+                REQUIRE((TimelineFile::read(path, cache) == -1));
+                std::remove(path.c_str());
+            }
+        }
+    }
+}
+
+#ifndef _WIN32
+
+SCENARIO("drum hits are sent as timestamped OSC bundles over UDP") {
+
+    GIVEN("A UDP listener on loopback and an OscSender pointing to it") {
+
+        // Bind a listener to a free port on loopback
+        int listener = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        REQUIRE((listener >= 0));
+
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = 0;
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        REQUIRE((bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0));
+
+        socklen_t address_length = sizeof(address);
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_length);
+        int port = ntohs(address.sin_port);
+
+        // Do not block forever if nothing arrives
+        timeval timeout {1, 0};
+        setsockopt(listener, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        OscSender sender;
+        REQUIRE(sender.open("127.0.0.1", port));
+
+        WHEN("two hits are added in one tick") {
+            uint64_t timetag = OscSender::timetag_from_now(50.0);
+            sender.begin_bundle();
+            sender.add_hit(36, 80, 12.0, timetag);
+            sender.add_hit(37, 60, 0.0, timetag);
+            REQUIRE((sender.num_hits() == 2));
+            REQUIRE(sender.send_bundle());
+
+            THEN("one bundle with both hits arrives") {
+                char buffer[512];
+                auto received = recv(listener, buffer, sizeof(buffer), 0);
+                REQUIRE((received > 0));
+
+                auto read_int32 = [&buffer](size_t pos) {
+                    return static_cast<int32_t>((static_cast<uint8_t>(buffer[pos]) << 24) | (static_cast<uint8_t>(buffer[pos+1]) << 16) | (static_cast<uint8_t>(buffer[pos+2]) << 8) | static_cast<uint8_t>(buffer[pos+3]));
+                };
+                auto read_uint64 = [&read_int32](size_t pos) {
+                    return (static_cast<uint64_t>(static_cast<uint32_t>(read_int32(pos))) << 32) | static_cast<uint32_t>(read_int32(pos + 4));
+                };
+
+                // Bundle header: "#bundle" and the immediate timetag
+                REQUIRE((std::string(buffer) == "#bundle"));
+                REQUIRE((read_uint64(8) == 1));
+
+                // First element: /trork/hit ,iift 36 80 12.0 timetag
+                size_t pos = 16;
+                int32_t size = read_int32(pos);
+                REQUIRE((size == 40));
+                pos += 4;
+                REQUIRE((std::string(buffer + pos) == "/trork/hit"));
+                REQUIRE((std::string(buffer + pos + 12) == ",iift"));
+                REQUIRE((read_int32(pos + 20) == 36));
+                REQUIRE((read_int32(pos + 24) == 80));
+                REQUIRE((read_uint64(pos + 32) == timetag));
+
+                // Second element
+                pos += size;
+                REQUIRE((read_int32(pos) == 40));
+                REQUIRE((read_int32(pos + 4 + 20) == 37));
+                REQUIRE((received == static_cast<decltype(received)>(pos + 4 + 40)));
+            }
+        }
+
+        WHEN("no hits are added in a tick") {
+            sender.begin_bundle();
+            THEN("nothing is sent") {
+                REQUIRE(sender.send_bundle());
+                char buffer[512];
+                REQUIRE((recv(listener, buffer, sizeof(buffer), MSG_DONTWAIT) < 0));
+            }
+        }
+
+        close(listener);
+    }
+}
+
+#endif